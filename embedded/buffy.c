@@ -1,6 +1,8 @@
 #include <string.h>
 
-#if TESTING
+// Benchmarks and stress tests build for the host too, but without the debug
+// output.
+#if TESTING && !NO_DEBUG_PRINTF
 #include <stdio.h>
 #define DEBUG_PRINTF(x...) printf(x)
 #else  // DEBUG
@@ -10,15 +12,53 @@
 
 // A bunch of stuff was cribbed and/or inspired by LK's cbuf.
 
+// Memory ordering. The debug port reads and writes the structure while the
+// target is running, so the buffer contents have to be ordered against the
+// head and tail updates that hand them over to the other side:
+//  - load_acquire(): later accesses can't happen before the load, used when
+//    reading the other side's index before touching the data it covers.
+//  - store_release(): earlier accesses complete before the store, used to
+//    publish our own index. This is the only barrier on the TX fast path.
+// Only ordering is needed, never completion, so DMB rather than DSB. The
+// compiler builtins emit DMB on ARMv6-M/v7-M, LDA/STL on ARMv8-M and plain
+// accesses on x86.
+#if defined(__ATOMIC_ACQUIRE)
+static inline uint32_t load_acquire(const volatile uint32_t* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(volatile uint32_t* p, uint32_t value) {
+  __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline void release_fence(void) {
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
 static inline void memory_barrier(void) {
-#if !TESTING
-  // On ARMv6m/v7: waits until memory is written out before returning.
-  __asm__ volatile("dsb" ::: "memory");
-#else  // TESTING
-// noop on host.
-#endif
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#else  // No C11 atomics builtins, assume an ARMv6-M/v7-M target.
+static inline void memory_barrier(void) {
+  __asm__ volatile("dmb" ::: "memory");
+}
+
+static inline uint32_t load_acquire(const volatile uint32_t* p) {
+  uint32_t value = *p;
+  memory_barrier();
+  return value;
+}
+
+static inline void store_release(volatile uint32_t* p, uint32_t value) {
+  memory_barrier();
+  *p = value;
 }
 
+static inline void release_fence(void) {
+  memory_barrier();
+}
+#endif
+
 static inline int min(int x, int y) {
   return x < y ? x : y;
 }
@@ -31,174 +71,790 @@ static inline uint32_t valpow2(uint32_t p2) {
   return 1LU << p2;
 }
 
-int buffy_tx(struct buffy* t, const char* buf, int len) {
-  int pos = 0;
-  DEBUG_PRINTF("tx: %d\n", len);
-  uint32_t tx_bufsize = valpow2(t->tx_len_pow2);
-  memory_barrier();
-  while (pos < len) {
-    // Make a local copy of tail and head, as the debug reader could modify
-    // the tail and mess up our calculations.
+// Buffer size specialization. The ring helpers take the buffer size as
+// an argument and are always inlined, so a caller that passes a constant gets
+// the masks and sizes folded into immediates. SPECIALIZE() calls such a
+// helper with the default size of INSTANTIATE_BUFFY when the instance has it,
+// and with the size read from the structure otherwise.
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+#define TX_DEFAULT_POW2 (32 - 1 - __builtin_clz(BUFFY_TX_BUF_SIZE))
+#define RX_DEFAULT_POW2 (32 - 1 - __builtin_clz(BUFFY_RX_BUF_SIZE))
+
+#if BUFFY_SPECIALIZE
+#define SPECIALIZE(len_pow2, default_pow2, fn, ...)                  \
+  ((len_pow2) == (default_pow2) ? fn(__VA_ARGS__, (default_pow2)) \
+                                : fn(__VA_ARGS__, (len_pow2)))
+#else  // !BUFFY_SPECIALIZE
+#define SPECIALIZE(len_pow2, default_pow2, fn, ...) fn(__VA_ARGS__, (len_pow2))
+#endif  // BUFFY_SPECIALIZE
+
+#if !BUFFY_USE_MEMCPY
+#if defined(__ARM_FEATURE_UNALIGNED) || defined(__i386__) || \
+    defined(__x86_64__)
+#define UNALIGNED_LOADS 1
+#endif
+
+typedef uint32_t __attribute__((may_alias)) word_t;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_word_t;
+
+// Copies len bytes between a buffer and the ring. Takes the place of
+// memcpy(), which is a byte loop in newlib-nano: aligns the destination,
+// then moves whole words, 16 bytes per LDM/STM pair on ARMv7-M. Only
+// [dst, dst + len) is ever written, so data next to it that the debug port
+// may be reading is left alone.
+#if defined(__GNUC__) && !defined(__clang__)
+// Keep GCC from turning the loops back into a memcpy() call.
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+#endif
+static void copy(void* dst, const void* src, int len) {
+  uint8_t* d = dst;
+  const uint8_t* s = src;
+  if (len >= 8) {
+    for (; (uintptr_t)d & 3; len--) *d++ = *s++;
+    if (((uintptr_t)s & 3) == 0) {
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || \
+    defined(__ARM_ARCH_8M_MAIN__)
+      // The registers in the list have to be in ascending order.
+      register uint32_t w0 __asm__("r3");
+      register uint32_t w1 __asm__("r4");
+      register uint32_t w2 __asm__("r5");
+      register uint32_t w3 __asm__("r12");
+      for (; len >= 16; len -= 16) {
+        __asm__ volatile(
+            "ldmia %[s]!, {%[w0], %[w1], %[w2], %[w3]}\n\t"
+            "stmia %[d]!, {%[w0], %[w1], %[w2], %[w3]}"
+            : [s] "+r"(s), [d] "+r"(d), [w0] "=&r"(w0), [w1] "=&r"(w1),
+              [w2] "=&r"(w2), [w3] "=&r"(w3)
+            :
+            : "memory");
+      }
+#endif
+      for (; len >= 4; len -= 4, s += 4, d += 4) {
+        *(word_t*)d = *(const word_t*)s;
+      }
+    }
+#if UNALIGNED_LOADS
+    for (; len >= 4; len -= 4, s += 4, d += 4) {
+      *(word_t*)d = *(const unaligned_word_t*)s;
+    }
+#endif
+  }
+  for (; len > 0; len--) *d++ = *s++;
+}
+#else  // BUFFY_USE_MEMCPY
+static inline void copy(void* dst, const void* src, int len) {
+  memcpy(dst, src, len);
+}
+#endif  // BUFFY_USE_MEMCPY
+
+#if BUFFY_MULTI_PRODUCER
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || \
+    defined(__ARM_ARCH_8M_MAIN__)
+// ARMv7-M: exclusive load/store. Exception entry and return clear the local
+// monitor, so an interrupt between LDREX and STREX makes the STREX fail and
+// we retry with fresh values.
+static inline int compare_and_swap(volatile uint32_t* p, uint32_t expected,
+                                   uint32_t desired) {
+  uint32_t failed;
+  do {
+    uint32_t value;
+    __asm__ volatile("ldrex %0, [%1]" : "=r"(value) : "r"(p) : "memory");
+    if (value != expected) {
+      __asm__ volatile("clrex" ::: "memory");
+      return 0;
+    }
+    __asm__ volatile("strex %0, %2, [%1]"
+                     : "=&r"(failed)
+                     : "r"(p), "r"(desired)
+                     : "memory");
+  } while (failed);
+  return 1;
+}
+
+static inline uint32_t atomic_add(volatile uint32_t* p, uint32_t delta) {
+  uint32_t value, failed;
+  do {
+    __asm__ volatile("ldrex %0, [%1]" : "=r"(value) : "r"(p) : "memory");
+    value += delta;
+    __asm__ volatile("strex %0, %2, [%1]"
+                     : "=&r"(failed)
+                     : "r"(p), "r"(value)
+                     : "memory");
+  } while (failed);
+  return value;
+}
+#elif defined(__ARM_ARCH_6M__) || defined(__ARM_ARCH_8M_BASE__)
+// ARMv6-M has no exclusive accesses, mask interrupts for the few
+// instructions that need to be atomic instead.
+static inline uint32_t irq_save(void) {
+  uint32_t primask;
+  __asm__ volatile("mrs %0, primask\n\tcpsid i" : "=r"(primask)::"memory");
+  return primask;
+}
+
+static inline void irq_restore(uint32_t primask) {
+  __asm__ volatile("msr primask, %0" ::"r"(primask) : "memory");
+}
+
+static inline int compare_and_swap(volatile uint32_t* p, uint32_t expected,
+                                   uint32_t desired) {
+  uint32_t primask = irq_save();
+  int swapped = (*p == expected);
+  if (swapped) *p = desired;
+  irq_restore(primask);
+  return swapped;
+}
+
+static inline uint32_t atomic_add(volatile uint32_t* p, uint32_t delta) {
+  uint32_t primask = irq_save();
+  uint32_t value = *p + delta;
+  *p = value;
+  irq_restore(primask);
+  return value;
+}
+#else  // Host and other targets: rely on the compiler builtins.
+#if TESTING
+void (*buffy_test_preempt_hook)(void);
+
+static inline void test_preempt(void) {
+  if (buffy_test_preempt_hook) buffy_test_preempt_hook();
+}
+#else  // !TESTING
+static inline void test_preempt(void) {}
+#endif  // TESTING
+
+static inline int compare_and_swap(volatile uint32_t* p, uint32_t expected,
+                                   uint32_t desired) {
+  int swapped = __atomic_compare_exchange_n(p, &expected, desired, 0,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  test_preempt();
+  return swapped;
+}
+
+static inline uint32_t atomic_add(volatile uint32_t* p, uint32_t delta) {
+  uint32_t value = __atomic_add_fetch(p, delta, __ATOMIC_SEQ_CST);
+  test_preempt();
+  return value;
+}
+#endif
+#else  // !BUFFY_MULTI_PRODUCER
+static inline uint32_t atomic_add(volatile uint32_t* p, uint32_t delta) {
+  return *p += delta;
+}
+#endif  // BUFFY_MULTI_PRODUCER
+
+// Splits up to len bytes of free space starting at 'start' into the spans
+// before and after the wrap-around. Returns the total length, or 0 if there
+// is less than min_len bytes of space.
+static ALWAYS_INLINE int tx_space(struct buffy* t, uint32_t start,
+                                  uint32_t tail, int min_len, int len,
+                                  struct buffy_span* span1,
+                                  struct buffy_span* span2,
+                                  uint32_t tx_len_pow2) {
+  uint32_t tx_bufsize = valpow2(tx_len_pow2);
+  uint32_t offset = modpow2(start, tx_len_pow2);
+  int free = tx_bufsize - (start - tail);
+  if (free < min_len) free = 0;
+  // Space from start up to the end of the buffer, the rest wraps around to
+  // the start of the buffer.
+  int first_len = min(tx_bufsize - offset, free);
+
+  span1->buf = t->tx_buf + offset;
+  span1->len = min(first_len, len);
+  span2->buf = t->tx_buf;
+  span2->len = min(free - first_len, len - span1->len);
+  return span1->len + span2->len;
+}
+
+// Copies len bytes to offset pos of a reservation.
+static void tx_copy(const struct buffy_span* span1,
+                    const struct buffy_span* span2, int pos, const void* src,
+                    int len) {
+  const uint8_t* from = src;
+  if (pos < span1->len) {
+    int first_len = min(span1->len - pos, len);
+    copy(span1->buf + pos, from, first_len);
+    from += first_len;
+    len -= first_len;
+    pos = 0;
+  } else {
+    pos -= span1->len;
+  }
+  copy(span2->buf + pos, from, len);
+}
+
+// Copies up to len bytes between tail and head out of a ring. Returns the
+// number of bytes copied.
+static ALWAYS_INLINE int ring_read(const uint8_t* ring, uint32_t tail,
+                                   uint32_t head, char* buf, int len,
+                                   uint32_t len_pow2) {
+  int read_len = min(head - tail, len);
+  uint32_t offset = modpow2(tail, len_pow2);
+  // Read to the end of the buffer, then wrap around.
+  int first_len = min(valpow2(len_pow2) - offset, read_len);
+  DEBUG_PRINTF("read_len: %d len_pow2: %d\n", read_len, len_pow2);
+  copy(buf, ring + offset, first_len);
+  copy(buf + first_len, ring, read_len - first_len);
+  return read_len;
+}
+
+#if !BUFFY_MULTI_PRODUCER
+// Copies len bytes into a ring, starting at position pos.
+static ALWAYS_INLINE void ring_write(uint8_t* ring, uint32_t pos,
+                                     const void* src, int len,
+                                     uint32_t len_pow2) {
+  uint32_t offset = modpow2(pos, len_pow2);
+  int first_len = min(valpow2(len_pow2) - offset, len);
+  copy(ring + offset, src, first_len);
+  copy(ring, (const uint8_t*)src + first_len, len - first_len);
+}
+
+// Drops the oldest records until there is room for a record of len bytes
+// (including the header). Returns the new tail.
+static ALWAYS_INLINE uint32_t tx_make_room(struct buffy* t, uint32_t tail,
+                                           uint32_t head, uint32_t len,
+                                           uint32_t tx_len_pow2) {
+  uint32_t tx_bufsize = valpow2(tx_len_pow2);
+  while (tx_bufsize - (head - tail) < len) {
+    uint16_t record_len;
+    ring_read(t->tx_buf, tail, tail + sizeof(record_len), (char*)&record_len,
+              sizeof(record_len), tx_len_pow2);
+    tail += BUFFY_RECORD_HEADER_SIZE + record_len;
+    if (head - tail > tx_bufsize) {
+      // Tail wasn't at a record boundary, the lengths are garbage. Drop
+      // everything.
+      DEBUG_PRINTF("bad record length, dropping all\n");
+      tail = head;
+    }
+  }
+  return tail;
+}
+
+// Waits for the host to make len bytes of room, see buffy_set_wait_hook().
+// Returns the new tail.
+static uint32_t tx_wait(struct buffy* t, uint32_t tail, uint32_t head,
+                        uint32_t len, uint32_t tx_len_pow2) {
+  uint32_t tx_bufsize = valpow2(tx_len_pow2);
+  // Don't wait if the host isn't draining the buffer.
+  if (tail == t->tx_stalled_tail) return tail;
+  for (uint32_t i = 0; i < t->tx_wait_limit; i++) {
+    t->tx_wait_hook();
+    uint32_t new_tail = t->tx_tail;
+    // Give up if the reader clobbered the tail, the next write resets it.
+    if (head - new_tail > tx_bufsize) return tail;
+    tail = new_tail;
+    if (tx_bufsize - (head - tail) >= len) return tail;
+  }
+  DEBUG_PRINTF("host stopped draining, dropping\n");
+  t->tx_stalled_tail = tail;
+  return tail;
+}
+#endif  // !BUFFY_MULTI_PRODUCER
+
+#if BUFFY_MULTI_PRODUCER
+// tx_writers holds the number of writers with reservations open in the low
+// half, and the number of writers ever registered in the high half. The
+// latter changes whenever a nested writer comes and goes, which the
+// compare-and-swaps on tx_writers below rely on.
+#define TX_WRITERS_OPEN 0xffffu
+#define TX_WRITER_ENTER 0x10001u
+
+// Called by every writer when it is done with its reservation. Writers nest
+// like the interrupts they run in, so the outermost one, once done, knows
+// that all the reserved space has been written, and publishes it. It does so
+// before unregistering: with no writers registered, head always equals
+// reserve.
+static void tx_writer_done(struct buffy* t) {
+  while (1) {
+    uint32_t writers = t->tx_writers;
+    if ((writers & TX_WRITERS_OPEN) != 1) {
+      // The writer we interrupted publishes our data.
+      atomic_add(&t->tx_writers, -1);
+      return;
+    }
+    store_release(&t->tx_head, t->tx_reserve);
+    // A writer that nested since reading tx_writers has reserved more, which
+    // needs publishing too.
+    if (compare_and_swap(&t->tx_writers, writers, writers - 1)) return;
+  }
+}
+#endif  // BUFFY_MULTI_PRODUCER
+
+// Accounts for a TX call that wanted len bytes but only got reserved.
+static void tx_count_drop(struct buffy* t, int len, int reserved) {
+  atomic_add(&t->tx_overflow_counter, 1);
+  atomic_add(&t->tx_dropped_bytes, len - reserved);
+  if (reserved == 0) atomic_add(&t->tx_dropped_records, 1);
+}
+
+// Reserves between min_len and len bytes, see buffy_tx_reserve().
+static ALWAYS_INLINE int tx_reserve_sized(struct buffy* t, int min_len,
+                                          int len, struct buffy_span* span1,
+                                          struct buffy_span* span2,
+                                          uint32_t tx_len_pow2) {
+  DEBUG_PRINTF("tx_reserve: %d\n", len);
+  uint32_t tx_bufsize = valpow2(tx_len_pow2);
+  span1->buf = span2->buf = t->tx_buf;
+  span1->len = span2->len = 0;
+  // Tail is read without a barrier: the buffer writes it allows depend on
+  // it through the free space check, and stores are not made visible
+  // speculatively.
+#if BUFFY_MULTI_PRODUCER
+  // Register as a writer, with a snapshot of reserve and head taken while
+  // nobody else registered or left.
+  uint32_t writers, reserve, head;
+  do {
+    writers = t->tx_writers;
+    reserve = t->tx_reserve;
+    head = t->tx_head;
+  } while (!compare_and_swap(&t->tx_writers, writers,
+                             writers + TX_WRITER_ENTER));
+  if ((writers & TX_WRITERS_OPEN) == 0) {
+    // No other writers, so nothing is reserved past head, unless the debug
+    // reader moved head. Reserve is only ever updated with a compare-and-swap,
+    // so a writer that interrupts us and reserves first makes ours fail
+    // instead of losing its space.
     uint32_t tail = t->tx_tail;
-    uint32_t head = t->tx_head;
     // Safety check - if the reader clobbers head or tail with wrong values,
     // reset it back to zeroes and fail this write.
-    if ((tail >= tx_bufsize) || (head >= tx_bufsize)) {
+    if (head - tail > tx_bufsize) {
       DEBUG_PRINTF("tail or head went out of bounds, resetting\n");
-      t->tx_tail = 0;
-      t->tx_head = 0;
-      memory_barrier();
+      if (compare_and_swap(&t->tx_reserve, reserve, 0)) t->tx_tail = 0;
+      // Publishes the reset reserve as head.
+      tx_writer_done(t);
       return 0;
     }
+    if (reserve != head) compare_and_swap(&t->tx_reserve, reserve, head);
+  }
+  int reserved;
+  uint32_t start;
+  do {
+    // Tail is owned by the debug reader, reserve by the writers. Anyone
+    // could move them under us, so work from local copies and only claim
+    // the space if nobody else has in the meantime.
+    uint32_t tail = t->tx_tail;
+    start = t->tx_reserve;
+    if (start - tail > tx_bufsize) {
+      DEBUG_PRINTF("tail or reserve went out of bounds\n");
+      tx_writer_done(t);
+      return 0;
+    }
+    DEBUG_PRINTF("reserve: %d tail: %d\n", start, tail);
+    reserved =
+        tx_space(t, start, tail, min_len, len, span1, span2, tx_len_pow2);
+  } while (reserved > 0 &&
+           !compare_and_swap(&t->tx_reserve, start, start + reserved));
+  if (reserved == 0) {
+    // No commit follows an empty reservation.
+    tx_writer_done(t);
+  }
+#else  // !BUFFY_MULTI_PRODUCER
+  // Make a local copy of tail and head, as the debug reader could modify
+  // the tail and mess up our calculations.
+  uint32_t tail = t->tx_tail;
+  uint32_t head = t->tx_head;
+  // Safety check - if the reader clobbers head or tail with wrong values,
+  // reset it back to zeroes and fail this write.
+  if (head - tail > tx_bufsize) {
+    DEBUG_PRINTF("tail or head went out of bounds, resetting\n");
+    t->tx_tail = 0;
+    t->tx_head = 0;
+    return 0;
+  }
 
-    DEBUG_PRINTF("head: %d tail: %d pos: %d\n", head, tail, pos);
-
-    int write_len;
-    if (head >= tail) {
-      if (tail == 0) {
-        // Special case for when tail is at 0. We don't want to write all the
-        // way to the end then.
-        write_len = valpow2(t->tx_len_pow2) - head - 1;
-      } else {
-        write_len = valpow2(t->tx_len_pow2) - head;
-      }
-    } else {
-      // Calculate size from the start of the buffer to tail.
-      write_len = tail - head - 1;
+  DEBUG_PRINTF("head: %d tail: %d\n", head, tail);
+  if (t->flags & BUFFY_FLAG_OVERWRITE) {
+    uint32_t record_len = BUFFY_RECORD_HEADER_SIZE + len;
+    if (record_len > tx_bufsize || record_len > 0xffff) {
+      // Doesn't fit even into an empty buffer.
+      tx_count_drop(t, len, 0);
+      return 0;
     }
-    if (write_len == 0) {
-      // Full.
-      t->tx_overflow_counter++;
+    uint32_t new_tail = tx_make_room(t, tail, head, record_len, tx_len_pow2);
+    if (new_tail != tail) {
+      // Let the host know before the old records get overwritten. Unlike
+      // the other index updates, this store has to be ordered before the
+      // stores that follow it, which takes a full barrier.
+      t->tx_tail = new_tail;
       memory_barrier();
-      break;
+      tail = new_tail;
     }
-    write_len = min(write_len, len - pos);
-    DEBUG_PRINTF("write_len: %d tx_len_pow2: %d\n", write_len, t->tx_len_pow2);
-    memcpy(t->tx_buf + head, buf + pos, write_len);
-
-    memory_barrier();
+    // The record header goes in front of the data, it is filled in on commit.
+    head += BUFFY_RECORD_HEADER_SIZE;
+  } else if (t->tx_wait_hook) {
+    uint32_t wanted = min(len, tx_bufsize);
+    if (tx_bufsize - (head - tail) < wanted) {
+      tail = tx_wait(t, tail, head, wanted, tx_len_pow2);
+    }
+  }
+  int reserved =
+      tx_space(t, head, tail, min_len, len, span1, span2, tx_len_pow2);
+#endif  // BUFFY_MULTI_PRODUCER
+  DEBUG_PRINTF("reserved: %d tx_len_pow2: %d\n", reserved, tx_len_pow2);
+  if (reserved < len) {
+    // Full.
+    tx_count_drop(t, len, reserved);
+  }
+  return reserved;
+}
 
-    // Write back to head. The tail could have been modified by the debug
-    // reader, but that's fine.
-    t->tx_head = modpow2(head + write_len, t->tx_len_pow2);
+// Generic version of the above, for the calls that aren't worth a copy per
+// buffer size.
+static int tx_reserve(struct buffy* t, int min_len, int len,
+                      struct buffy_span* span1, struct buffy_span* span2) {
+  return tx_reserve_sized(t, min_len, len, span1, span2, t->tx_len_pow2);
+}
 
-    memory_barrier();
+int buffy_tx_reserve(struct buffy* t, int len, struct buffy_span* span1,
+                     struct buffy_span* span2) {
+  return tx_reserve(t, 1, len, span1, span2);
+}
 
-    pos += write_len;
+// Publishes n reserved bytes, see buffy_tx_commit().
+static ALWAYS_INLINE void tx_commit_sized(struct buffy* t, int n,
+                                          uint32_t tx_len_pow2) {
+  DEBUG_PRINTF("tx_commit: %d\n", n);
+  if (n <= 0) return;
+
+#if BUFFY_MULTI_PRODUCER
+  // Make sure the data is written out before the host can see the new head.
+  // The head itself is published with a compare-and-swap, which has no
+  // ordering of its own on ARMv6-M/v7-M.
+  release_fence();
+  tx_writer_done(t);
+#else  // !BUFFY_MULTI_PRODUCER
+  uint32_t head = t->tx_head;
+  if (t->flags & BUFFY_FLAG_OVERWRITE) {
+    uint16_t record_len = n;
+    ring_write(t->tx_buf, head, &record_len, sizeof(record_len), tx_len_pow2);
+    head += BUFFY_RECORD_HEADER_SIZE;
+    t->tx_records++;
   }
 
-  return pos;
+  // Publish the data. The tail could have been modified by the debug reader,
+  // but that's fine.
+  store_release(&t->tx_head, head + n);
+#endif  // BUFFY_MULTI_PRODUCER
 }
 
-int buffy_tx_buffer_read(struct buffy* t, char* buf, int len) {
+void buffy_tx_commit(struct buffy* t, int n) {
+  tx_commit_sized(t, n, t->tx_len_pow2);
+}
+
+static ALWAYS_INLINE int tx_sized(struct buffy* t, const char* buf, int len,
+                                  uint32_t tx_len_pow2) {
+  struct buffy_span span1, span2;
+  int reserved = tx_reserve_sized(t, 1, len, &span1, &span2, tx_len_pow2);
+  if (reserved == 0) return 0;
+  tx_copy(&span1, &span2, 0, buf, reserved);
+  tx_commit_sized(t, reserved, tx_len_pow2);
+  return reserved;
+}
+
+int buffy_tx(struct buffy* t, const char* buf, int len) {
+  DEBUG_PRINTF("tx: %d\n", len);
+  return SPECIALIZE(t->tx_len_pow2, TX_DEFAULT_POW2, tx_sized, t, buf, len);
+}
+
+int buffy_tx_all(struct buffy* t, const char* buf, int len) {
+  const struct buffy_iovec iov = {buf, len};
+  return buffy_txv(t, &iov, 1);
+}
+
+static ALWAYS_INLINE int txv_sized(struct buffy* t,
+                                   const struct buffy_iovec* iov, int n,
+                                   int len, uint32_t tx_len_pow2) {
+  struct buffy_span span1, span2;
+  // Partial records can't be decoded, so it's all or nothing.
+  if (tx_reserve_sized(t, len, len, &span1, &span2, tx_len_pow2) == 0) {
+    return 0;
+  }
   int pos = 0;
-  DEBUG_PRINTF("tx_read: %d\n", len);
-  memory_barrier();
-  while (pos < len) {
-    uint32_t tail = t->tx_tail;
-    uint32_t head = t->tx_head;
+  for (int i = 0; i < n; i++) {
+    tx_copy(&span1, &span2, pos, iov[i].buf, iov[i].len);
+    pos += iov[i].len;
+  }
+  tx_commit_sized(t, len, tx_len_pow2);
+  return len;
+}
 
-    DEBUG_PRINTF("head: %d tail: %d pos: %d\n", head, tail, pos);
+int buffy_txv(struct buffy* t, const struct buffy_iovec* iov, int n) {
+  int len = 0;
+  for (int i = 0; i < n; i++) len += iov[i].len;
+  DEBUG_PRINTF("txv: %d %d\n", n, len);
+  return SPECIALIZE(t->tx_len_pow2, TX_DEFAULT_POW2, txv_sized, t, iov, n,
+                    len);
+}
+
+// COBS frame length for len bytes of data: one code byte per zero byte in
+// the data plus the first one, an extra one after every run of 254 non-zero
+// bytes, and the delimiter.
+static int cobs_frame_len(const uint8_t* data, int len) {
+  int frame_len = len + 2;
+  int run = 0;
+  for (int i = 0; i < len; i++) {
+    if (data[i] == 0) {
+      run = 0;
+    } else if (++run == 254) {
+      frame_len++;
+      run = 0;
+    }
+  }
+  return frame_len;
+}
 
-    if (head == tail) return pos;
+// Returns the byte at offset pos of a reservation.
+static inline uint8_t* span_byte(const struct buffy_span* span1,
+                                 const struct buffy_span* span2, int pos) {
+  return pos < span1->len ? span1->buf + pos : span2->buf + pos - span1->len;
+}
 
-    int read_len;
-    if (head > tail) {
-      // No wrap-around.
-      read_len = head - tail;
-    } else {
-      // Read to the end of the buffer.
-      read_len = valpow2(t->tx_len_pow2) - tail;
+int buffy_tx_frame(struct buffy* t, const char* buf, int len) {
+  const uint8_t* data = (const uint8_t*)buf;
+  int frame_len = cobs_frame_len(data, len);
+  DEBUG_PRINTF("tx_frame: %d %d\n", len, frame_len);
+  struct buffy_span span1, span2;
+  if (tx_reserve(t, frame_len, frame_len, &span1, &span2) == 0) return 0;
+  // Each block starts with a code byte: 1 + the number of non-zero bytes that
+  // follow it. The code byte is filled in once the block is done.
+  int code_pos = 0;
+  int pos = 1;
+  uint8_t code = 1;
+  for (int i = 0; i < len; i++) {
+    if (data[i] != 0) {
+      *span_byte(&span1, &span2, pos++) = data[i];
+      if (++code != 0xff) continue;
     }
-    read_len = min(read_len, len - pos);
-    DEBUG_PRINTF("read_len: %d tx_len_pow2: %d\n", read_len, t->tx_len_pow2);
-    memcpy(buf + pos, t->tx_buf + tail, read_len);
+    *span_byte(&span1, &span2, code_pos) = code;
+    code_pos = pos++;
+    code = 1;
+  }
+  *span_byte(&span1, &span2, code_pos) = code;
+  *span_byte(&span1, &span2, pos) = 0;
+  buffy_tx_commit(t, frame_len);
+  return len;
+}
 
-    memory_barrier();
+#if !BUFFY_MULTI_PRODUCER
+void buffy_set_wait_hook(struct buffy* t, void (*wait)(void),
+                         uint32_t max_waits) {
+  t->tx_wait_limit = max_waits;
+  t->tx_wait_hook = wait;
+}
 
-    t->tx_tail = modpow2(tail + read_len, t->tx_len_pow2);
+// Writes value as a LEB128 varint, returns the number of bytes used.
+static int put_varint(uint8_t* out, uint64_t value) {
+  int n = 0;
+  for (; value >= 0x80; value >>= 7) out[n++] = value | 0x80;
+  out[n++] = value;
+  return n;
+}
 
-    memory_barrier();
+void buffy_set_tick_hook(struct buffy* t, uint32_t (*tick)(void)) {
+  t->tx_tick_hook = tick;
+  t->tx_sync_countdown = 0;
+}
+
+int buffy_tx_timestamped(struct buffy* t, const char* buf, int len) {
+  uint32_t now = t->tx_tick_hook ? t->tx_tick_hook() : 0;
+  // Up to 33 bits of time and 32 bits of length, 5 bytes each.
+  uint8_t header[10];
+  int sync = t->tx_sync_countdown == 0;
+  uint64_t time = sync ? (uint64_t)now << 1 | 1
+                       : (uint64_t)(uint32_t)(now - t->tx_last_tick) << 1;
+  int header_len = put_varint(header, time);
+  header_len += put_varint(header + header_len, len);
+  DEBUG_PRINTF("tx_timestamped: %d %d\n", len, header_len);
+  const struct buffy_iovec iov[] = {
+      {header, header_len},
+      {buf, len},
+  };
+  // Dropped records don't move the time base, the next delta is still
+  // relative to the last record the host gets.
+  if (buffy_txv(t, iov, 2) == 0) return 0;
+  t->tx_last_tick = now;
+  t->tx_sync_countdown =
+      sync ? BUFFY_TIMESTAMP_SYNC_INTERVAL - 1 : t->tx_sync_countdown - 1;
+  return len;
+}
+#endif  // !BUFFY_MULTI_PRODUCER
+
+int buffy_log(struct buffy* t, uint32_t id, const uint32_t* args, int nargs) {
+  DEBUG_PRINTF("log: %x %d\n", id, nargs);
+  const struct buffy_iovec iov[] = {
+      {&id, sizeof(id)},
+      {args, nargs * sizeof(*args)},
+  };
+  return buffy_txv(t, iov, 2);
+}
 
-    pos += read_len;
+int buffy_tx_buffer_read(struct buffy* t, char* buf, int len) {
+  DEBUG_PRINTF("tx_read: %d\n", len);
+  uint32_t tail = t->tx_tail;
+  uint32_t head = load_acquire(&t->tx_head);
+
+  DEBUG_PRINTF("head: %d tail: %d\n", head, tail);
+
+  if (head - tail > valpow2(t->tx_len_pow2)) return 0;
+
+#if !BUFFY_MULTI_PRODUCER
+  if (t->flags & BUFFY_FLAG_OVERWRITE) {
+    // Only whole records, the target drops them from the tail by their
+    // length headers.
+    uint32_t end = tail;
+    while (head - end >= BUFFY_RECORD_HEADER_SIZE) {
+      uint16_t record_len;
+      ring_read(t->tx_buf, end, end + sizeof(record_len), (char*)&record_len,
+                sizeof(record_len), t->tx_len_pow2);
+      uint32_t next = end + BUFFY_RECORD_HEADER_SIZE + record_len;
+      if (head - next > head - end || next - tail > (uint32_t)len) break;
+      end = next;
+    }
+    head = end;
   }
+#endif  // !BUFFY_MULTI_PRODUCER
+
+  int read_len = ring_read(t->tx_buf, tail, head, buf, len, t->tx_len_pow2);
 
-  return pos;
+  store_release(&t->tx_tail, tail + read_len);
+
+  return read_len;
 }
 
 int buffy_tx_get_buffer_size(struct buffy* t) {
-  // We can't store full 2**x bytes as we couldn't distinguish from an empty
-  // buffer then.
-  return valpow2(t->tx_len_pow2) - 1;
+  return valpow2(t->tx_len_pow2);
 }
 
 int buffy_tx_get_buffer_free(struct buffy* t) {
-  uint32_t tail = t->tx_tail;
-  uint32_t head = t->tx_head;
-  if (head >= tail) {
-    if (tail == 0) {
-      // Special case for when tail is at 0. We don't want to write all the
-      // way to the end then.
-      return valpow2(t->tx_len_pow2) - head - 1;
-    } else {
-      // From head -> end.
-      int second_half = valpow2(t->tx_len_pow2) - head;
-      // From start to tail - 1.
-      int first_half = tail - 1;
-      return second_half + first_half;
-    }
-  } else {
-    return tail - head - 1;
+#if BUFFY_MULTI_PRODUCER
+  // Space reserved by writers that haven't committed yet isn't free either.
+  uint32_t used = t->tx_reserve - t->tx_tail;
+#else
+  uint32_t used = t->tx_head - t->tx_tail;
+#endif
+  uint32_t tx_bufsize = valpow2(t->tx_len_pow2);
+  return used > tx_bufsize ? 0 : tx_bufsize - used;
+}
+
+static ALWAYS_INLINE int rx_sized(struct buffy* t, char* buf, int len,
+                                  uint32_t rx_len_pow2) {
+  // Make a local copy of tail and head, as the debug writer could modify
+  // the head and mess up our calculations.
+  uint32_t tail = t->rx_tail;
+  uint32_t head = load_acquire(&t->rx_head);
+
+  // Safety check - if the writer clobbers head or tail with wrong values,
+  // reset it back to zeroes and fail this read.
+  if (head - tail > valpow2(rx_len_pow2)) {
+    DEBUG_PRINTF("tail or head went out of bounds, resetting\n");
+    t->rx_tail = 0;
+    t->rx_head = 0;
+    return 0;
   }
+
+  DEBUG_PRINTF("head: %d tail: %d\n", head, tail);
+
+  int read_len = ring_read(t->rx_buf, tail, head, buf, len, rx_len_pow2);
+
+  // Write back to tail. The head could have been modified by the debug
+  // writer, but that's fine.
+  store_release(&t->rx_tail, tail + read_len);
+
+  return read_len;
 }
 
 int buffy_rx(struct buffy* t, char* buf, int len) {
-  int pos = 0;
   DEBUG_PRINTF("rx: %d\n", len);
+  return SPECIALIZE(t->rx_len_pow2, RX_DEFAULT_POW2, rx_sized, t, buf, len);
+}
+
+int buffy_rx_peek(struct buffy* t, struct buffy_span* span1,
+                  struct buffy_span* span2) {
   uint32_t rx_bufsize = valpow2(t->rx_len_pow2);
-  memory_barrier();
-  while (pos < len) {
-    // Make a local copy of tail and head, as the debug writer could modify
-    // the head and mess up our calculations.
-    uint32_t tail = t->rx_tail;
-    uint32_t head = t->rx_head;
+  uint32_t tail = t->rx_tail;
+  uint32_t head = load_acquire(&t->rx_head);
+  span1->buf = span2->buf = t->rx_buf;
+  span1->len = span2->len = 0;
+  if (head - tail > rx_bufsize) {
+    DEBUG_PRINTF("tail or head went out of bounds, resetting\n");
+    t->rx_tail = 0;
+    t->rx_head = 0;
+    return 0;
+  }
+  DEBUG_PRINTF("rx_peek: head: %d tail: %d\n", head, tail);
+  uint32_t offset = modpow2(tail, t->rx_len_pow2);
+  int used = head - tail;
+  span1->buf = t->rx_buf + offset;
+  span1->len = min(rx_bufsize - offset, used);
+  span2->len = used - span1->len;
+  return used;
+}
 
-    // Safety check - if the reader clobbers head or tail with wrong values,
-    // reset it back to zeroes and fail this write.
-    if ((tail >= rx_bufsize) || (head >= rx_bufsize)) {
-      DEBUG_PRINTF("tail or head went out of bounds, resetting\n");
-      t->rx_tail = 0;
-      t->rx_head = 0;
-      memory_barrier();
-      return 0;
-    }
+void buffy_rx_consume(struct buffy* t, int n) {
+  DEBUG_PRINTF("rx_consume: %d\n", n);
+  if (n <= 0) return;
+  // The host may reuse the space as soon as it sees the new tail, so all our
+  // reads of it have to be done by then.
+  store_release(&t->rx_tail, t->rx_tail + n);
+}
 
-    DEBUG_PRINTF("head: %d tail: %d pos: %d\n", head, tail, pos);
+// Calls the handler for command id. Returns 0 if there is none.
+static int dispatch(struct buffy* t, const struct buffy_command* commands,
+                    int n, uint8_t id, const uint8_t* data, int len) {
+  for (int i = 0; i < n; i++) {
+    if (commands[i].id == id) {
+      commands[i].handler(t, data, len);
+      return 1;
+    }
+  }
+  DEBUG_PRINTF("unknown command: %d\n", id);
+  return 0;
+}
 
-    if (head == tail) return pos;
+int buffy_rx_poll(struct buffy* t, const struct buffy_command* commands,
+                  int n) {
+  uint32_t rx_len_pow2 = t->rx_len_pow2;
+  uint32_t rx_bufsize = valpow2(rx_len_pow2);
+  uint32_t tail = t->rx_tail;
+  uint32_t head = load_acquire(&t->rx_head);
+  if (head - tail > rx_bufsize) {
+    DEBUG_PRINTF("tail or head went out of bounds, resetting\n");
+    t->rx_tail = 0;
+    t->rx_head = 0;
+    return 0;
+  }
 
-    int read_len;
-    if (head > tail) {
-      // No wrap-around.
-      read_len = head - tail;
+  int handled = 0;
+  while (head - tail >= BUFFY_COMMAND_HEADER_SIZE) {
+    uint8_t header[BUFFY_COMMAND_HEADER_SIZE];
+    ring_read(t->rx_buf, tail, head, (char*)header, sizeof(header),
+              rx_len_pow2);
+    int len = header[2] | header[3] << 8;
+    uint32_t frame_len = BUFFY_COMMAND_HEADER_SIZE + len;
+    DEBUG_PRINTF("rx_poll: id %d len %d\n", header[0], len);
+    if (frame_len > rx_bufsize) {
+      // Can't ever be complete, so we've lost track of the frames.
+      DEBUG_PRINTF("command too long, dropping all\n");
+      store_release(&t->rx_tail, head);
+      break;
+    }
+    if (head - tail < frame_len) break;  // The rest is still on its way.
+
+    uint32_t start = tail + BUFFY_COMMAND_HEADER_SIZE;
+    uint32_t offset = modpow2(start, rx_len_pow2);
+    if (offset + len <= rx_bufsize) {
+      handled += dispatch(t, commands, n, header[0], t->rx_buf + offset, len);
+    } else if (len <= BUFFY_COMMAND_BUF_SIZE) {
+      uint8_t data[BUFFY_COMMAND_BUF_SIZE];
+      ring_read(t->rx_buf, start, head, (char*)data, len, rx_len_pow2);
+      handled += dispatch(t, commands, n, header[0], data, len);
     } else {
-      // Read to the end of the buffer.
-      read_len = valpow2(t->rx_len_pow2) - tail;
+      DEBUG_PRINTF("wrapped command too long: %d\n", len);
     }
-    read_len = min(read_len, len - pos);
-    DEBUG_PRINTF("read_len: %d rx_len_pow2: %d\n", read_len, t->rx_len_pow2);
-    memcpy(buf + pos, t->rx_buf + tail, read_len);
-
-    memory_barrier();
-
-    // Write back to tail. The head could have been modified by the debug
-    // writer, but that's fine.
-    t->rx_tail = modpow2(tail + read_len, t->rx_len_pow2);
-
-    memory_barrier();
-
-    pos += read_len;
+    // Only hand the space back once the handler is done with the data.
+    tail += frame_len;
+    store_release(&t->rx_tail, tail);
   }
-
-  return pos;
+  return handled;
 }
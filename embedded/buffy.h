@@ -2,6 +2,10 @@
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Buffer sizes, must be powers of 2.
 #ifndef BUFFY_TX_BUF_SIZE
 #define BUFFY_TX_BUF_SIZE 512
@@ -11,24 +15,150 @@
 #define BUFFY_RX_BUF_SIZE 64
 #endif
 
+// Set to 1 to allow calling the TX functions from several contexts that can
+// preempt each other (thread, ISRs, DMA callbacks) on a single core.
+//
+// Space is then reserved with a lock-free compare-and-swap (LDREX/STREX on
+// ARMv7-M, a short interrupt-masked section on ARMv6-M), and data is published
+// to the host in reservation order: the outermost writer publishes once all
+// the nested ones are done, so the host never sees a partially written record.
+#ifndef BUFFY_MULTI_PRODUCER
+#define BUFFY_MULTI_PRODUCER 0
+#endif
+
+// Set to 1 to copy data in and out of the buffers with the C library's
+// memcpy() instead of buffy's own word copy. Mostly useful for comparing the
+// two, newlib-nano's memcpy() is a byte loop.
+#ifndef BUFFY_USE_MEMCPY
+#define BUFFY_USE_MEMCPY 0
+#endif
+
+// Set to 0 to leave out the copies of buffy_tx(), buffy_txv() and buffy_rx()
+// built for the default buffer sizes above. With them, instances of the
+// default sizes (INSTANTIATE_BUFFY) run code with the sizes as constants,
+// while the rest take the generic path that reads them from the structure.
+#ifndef BUFFY_SPECIALIZE
+#define BUFFY_SPECIALIZE 1
+#endif
+
+// Command frames that wrap around the end of the RX buffer are copied into
+// a stack buffer of this size before being handed to their handler, see
+// buffy_rx_poll(). Longer wrapped frames are dropped.
+#ifndef BUFFY_COMMAND_BUF_SIZE
+#define BUFFY_COMMAND_BUF_SIZE BUFFY_RX_BUF_SIZE
+#endif
+
+// Timestamped records carry the absolute time instead of the delta to the
+// previous record once every this many records, see buffy_tx_timestamped().
+#ifndef BUFFY_TIMESTAMP_SYNC_INTERVAL
+#define BUFFY_TIMESTAMP_SYNC_INTERVAL 64
+#endif
+
 // First version of buffy used 0xdd664662.
 //
 // The new version now also includes a version field in the structure.
 #define BUFFY_MAGIC 0xdd664642  // BFfY'
 
+// Structure versions:
+// 1: heads/tails are indexes into the buffers, wrapped to the buffer size.
+//    One byte of each buffer is left unused to tell a full buffer from an
+//    empty one.
+// 2: heads/tails are free-running byte counters that are only wrapped when
+//    indexing into the buffers (counter & (size - 1)). Used space is
+//    head - tail, and the whole buffer can be filled.
+// 3: same as 2, plus the host-writable tx_level severity threshold at offset
+//    64.
+#define BUFFY_VERSION 3
+
+// Flight recorder mode: when the TX buffer is full, drop the oldest records
+// to make room for new ones instead of dropping the new data.
+//
+// To know where records start, every write to the TX buffer is then prefixed
+// with a 16-bit little-endian length (BUFFY_RECORD_HEADER_SIZE bytes), and
+// tx_records counts the records written. The target moves tx_tail itself, so
+// the host must not write it back. Instead, it should keep its own read
+// position and re-read tx_tail after copying data out: everything before
+// tx_tail has been overwritten, and tx_records tells how many records were
+// lost. Not supported with BUFFY_MULTI_PRODUCER, where the flag must not be
+// set: INSTANTIATE_BUFFY_FLIGHT_RECORDER() doesn't build there.
+#define BUFFY_FLAG_OVERWRITE 0x01
+
+#define BUFFY_RECORD_HEADER_SIZE 2
+
+// Severity levels for BUFFY_LOG_LEVEL() and BUFFY_LEVEL_ENABLED().
+#define BUFFY_LEVEL_DEBUG 0
+#define BUFFY_LEVEL_INFO 1
+#define BUFFY_LEVEL_WARNING 2
+#define BUFFY_LEVEL_ERROR 3
+
 struct buffy {
   const uint32_t magic;       // 0
   const uint8_t version;      // 4
   const uint8_t tx_len_pow2;  // 5 - TX buffer size as log2 of the size.
   const uint8_t rx_len_pow2;  // 6 - RX buffer size as log2 of the size.
-  const uint8_t initialized;  // 7
-  volatile uint32_t tx_tail;  // 8 - heads/tails as indexes.
+  const uint8_t flags;        // 7 - BUFFY_FLAG_* options.
+  volatile uint32_t tx_tail;  // 8 - heads/tails as free-running counters.
   volatile uint32_t tx_head;  // 12
   volatile uint32_t rx_tail;  // 16
   volatile uint32_t rx_head;  // 20
   volatile uint32_t tx_overflow_counter;  // 24
   uint8_t* tx_buf;                        // 28 - pointer to tx buffer.
   uint8_t* rx_buf;                        // 32 - pointer to rx buffer.
+  // Past the header above, the host reads tx_records and the drop
+  // statistics (44-52), and writes tx_level (64). Everything else is
+  // target-only state.
+  volatile uint32_t tx_reserve;  // 36 - end of reserved TX space.
+  // 40 - writers with reservations open (low 16 bits) and registered so far
+  // (high 16 bits), with BUFFY_MULTI_PRODUCER.
+  volatile uint32_t tx_writers;
+  // Number of records written, see BUFFY_FLAG_OVERWRITE.
+  volatile uint32_t tx_records;  // 44
+  // Drop statistics, on top of tx_overflow_counter which counts the TX calls
+  // that could not write everything they were asked to.
+  volatile uint32_t tx_dropped_bytes;    // 48 - bytes not written.
+  volatile uint32_t tx_dropped_records;  // 52 - calls that wrote nothing.
+  // Timestamp state, see buffy_tx_timestamped(): tick of the last record,
+  // records until the next absolute time, and the clock.
+  uint32_t tx_last_tick;       // 56
+  uint32_t tx_sync_countdown;  // 60
+  // Minimum severity of records to write, see BUFFY_LEVEL_ENABLED(). Written
+  // by the host at runtime to throttle logging.
+  volatile uint32_t tx_level;      // 64
+  uint32_t (*tx_tick_hook)(void);  // 68
+  // Lossless mode, see buffy_set_wait_hook(): called while waiting for the
+  // host to make room, at most tx_wait_limit times per write. tx_stalled_tail
+  // is the tail at which the host last stopped draining.
+  void (*tx_wait_hook)(void);  // 72
+  uint32_t tx_wait_limit;      // 76
+  uint32_t tx_stalled_tail;    // 80
+};
+
+// True if records of the given severity pass the channel's tx_level
+// threshold. Check this before formatting anything expensive for buffy_tx().
+#define BUFFY_LEVEL_ENABLED(t, level) ((uint32_t)(level) >= (t)->tx_level)
+
+// Root descriptor for targets with several buffy instances ("channels").
+//
+// Instead of scanning memory for every BUFFY_MAGIC, the host finds the single
+// BUFFY_ROOT_MAGIC and reads the names and structure addresses of all the
+// channels in one go: the channel table directly follows the root header.
+#define BUFFY_ROOT_MAGIC 0xdd664652  // RFfY'
+#define BUFFY_ROOT_VERSION 1
+
+// Channel names are NUL-padded, up to this many characters.
+#define BUFFY_CHANNEL_NAME_LEN 12
+
+struct buffy_channel {
+  const char name[BUFFY_CHANNEL_NAME_LEN];  // 0
+  struct buffy* const buffy;                // 12 - pointer to the channel.
+};
+
+struct buffy_root {
+  const uint32_t magic;                   // 0
+  const uint8_t version;                  // 4
+  const uint8_t channel_count;            // 5
+  const uint8_t reserved[2];              // 6
+  const struct buffy_channel channels[];  // 8 - 16 bytes per channel.
 };
 
 // Transmit buffer: from embedded to host.
@@ -39,25 +169,232 @@ struct buffy {
 // than requested number if there is no space in the buffer.
 int buffy_tx(struct buffy* t, const char* buf, int len);
 
+// Like buffy_tx(), but writes all len bytes or none of them, so the host
+// never sees a truncated record.
+//
+// Returns len, or 0 if there was not enough space, in which case the record
+// is counted in tx_dropped_records.
+int buffy_tx_all(struct buffy* t, const char* buf, int len);
+
+// One fragment of a record for buffy_txv().
+struct buffy_iovec {
+  const void* buf;
+  int len;
+};
+
+// Queues a record made of n fragments (e.g. header, payload and trailer), as
+// if they had been concatenated. Space for the whole record is reserved at
+// once and the head is published once, so the host sees either all of the
+// record or none of it, and other writers can't interleave with it.
+//
+// Returns the total length of the record, or 0 if it did not fit, in which
+// case nothing is written and tx_overflow_counter is incremented.
+int buffy_txv(struct buffy* t, const struct buffy_iovec* iov, int n);
+
+// Framed transmission.
+// ====================
+// Sends len bytes as one COBS (Consistent Overhead Byte Stuffing) frame: the
+// data is re-encoded without any zero bytes, at a cost of one byte plus one
+// per 254 bytes, and the frame is terminated by a zero byte. The encoder
+// writes straight into the TX buffer. After losing data, the host decoder
+// (see host/frame_decoder.h) skips to the next zero byte and picks up from
+// the frame after it. For that to work, everything sent on the channel has
+// to be framed.
+//
+// The frame is written all or nothing. Returns len, or 0 if the frame did not
+// fit.
+int buffy_tx_frame(struct buffy* t, const char* buf, int len);
+
+#if !BUFFY_MULTI_PRODUCER
+// Lossless mode.
+// ==============
+// By default, data that doesn't fit in the TX buffer is dropped. With a wait
+// hook set, the TX functions instead wait for the host to make room for the
+// whole write (or as much of it as the buffer can hold), calling wait()
+// between checks of the tail, e.g. an RTOS delay, or __WFE() with the host
+// sending events. After max_waits calls without enough room, the write
+// falls back to dropping as usual.
+//
+// The functions only wait while a host is draining the buffer: not until
+// the tail has moved for the first time, and not again after a timeout until
+// it moves again. Units without a debugger attached never block. Flight
+// recorder instances never wait. Not supported with BUFFY_MULTI_PRODUCER,
+// where a writer nested inside another one would wait for data the host
+// can't get until the outer writer is done.
+void buffy_set_wait_hook(struct buffy* t, void (*wait)(void),
+                         uint32_t max_waits);
+
+// Timestamped records.
+// ====================
+// Sets the clock for buffy_tx_timestamped(): a function returning a free
+// running 32-bit tick count, e.g. DWT->CYCCNT, a SysTick driven counter or
+// the low half of a 64-bit timer. Write records at least once per wrap of the
+// counter, or the host loses track of whole wraps.
+void buffy_set_tick_hook(struct buffy* t, uint32_t (*tick)(void));
+
+// Writes len bytes as a timestamped record, all or nothing:
+//
+//   varint time, varint len, data
+//
+// time is (ticks since the previous record) << 1, so usually 1-2 bytes. Every
+// BUFFY_TIMESTAMP_SYNC_INTERVAL records (and for the first one) it is
+// (absolute ticks) << 1 | 1 instead, so the host can find its place again
+// after losing records. varints are LEB128: 7 bits per byte, least
+// significant first, top bit set on all but the last byte. The host side is
+// host/timestamp_decoder.h.
+//
+// Returns len, or 0 if the record did not fit. Only use timestamped records
+// on a channel that carries them exclusively. Not supported with
+// BUFFY_MULTI_PRODUCER, where nested writers could publish records out of
+// timestamp order.
+int buffy_tx_timestamped(struct buffy* t, const char* buf, int len);
+#endif  // !BUFFY_MULTI_PRODUCER
+
+// A contiguous region of the TX or RX buffer, see buffy_tx_reserve() and
+// buffy_rx_peek().
+struct buffy_span {
+  uint8_t* buf;
+  int len;
+};
+
+// Reserves up to len bytes in the transmit buffer for writing in place.
+//
+// The reserved space is returned as two spans: span1 starts at the current
+// head, span2 continues at the start of the buffer if the reservation wraps
+// around (span2->len is 0 otherwise). Write the data into span1 followed by
+// span2, then call buffy_tx_commit() to hand it over to the host. Nothing is
+// visible to the host until then.
+//
+// Returns the total number of bytes reserved (span1->len + span2->len). This
+// might be smaller than len if there is no space in the buffer, in which case
+// tx_overflow_counter is incremented, same as for buffy_tx().
+int buffy_tx_reserve(struct buffy* t, int len, struct buffy_span* span1,
+                     struct buffy_span* span2);
+
+// Publishes the first n bytes of the last reservation to the host. n must not
+// be larger than the number of bytes returned by buffy_tx_reserve(). The rest
+// of the reservation is released.
+//
+// With BUFFY_MULTI_PRODUCER, other writers might have already reserved the
+// space after ours, so reservations can't be shrunk: every reservation that
+// returned a non-zero length must be committed exactly once with its full
+// length.
+void buffy_tx_commit(struct buffy* t, int n);
+
+#if TESTING && BUFFY_MULTI_PRODUCER
+// Called after every atomic operation of the TX path in host builds, so that
+// tests can run a nested writer everywhere an interrupt could.
+extern void (*buffy_test_preempt_hook)(void);
+#endif
+
 // Attempts to read from the *transmit* buffer (characters that are pending
 // host's) read. You would typically not want to use this. Also, there is
 // no synchronization between this and the reader on the host. So if there is
 // a host reader and it updates the pointers through the debug interface,
 // interesting things might happen.
 //
+// In flight recorder mode (BUFFY_FLAG_OVERWRITE), only whole records are
+// read, headers included, so that the tail stays on a record boundary.
+//
 // Returns number of characters written to 'buf' (up to 'len').
 int buffy_tx_buffer_read(struct buffy* t, char* buf, int len);
 
 // Returns the usable size of the TX buffer in bytes.
 //
-// This includes bytes that have not yet been read out). Due to circular buffer
-// implementation reasons the usable buffer size is one smaller than the actual
-// buffer. This is accounted for in the return value of this function.
+// This includes bytes that have not yet been read out.
 int buffy_tx_get_buffer_size(struct buffy* t);
 
-// Returns number of bytes free in the TX buffer.
+// Returns number of bytes free in the TX buffer. With BUFFY_MULTI_PRODUCER,
+// space reserved by writers that haven't committed yet is not free.
 int buffy_tx_get_buffer_free(struct buffy* t);
 
+// Deferred formatting binary logging.
+// ===================================
+// BUFFY_LOG(t, fmt, ...) logs a printf-style message without formatting it on
+// the target. The format string goes to the "buffy_fmt" section, and only
+// a record of the format string ID (its offset in that section) followed by
+// the arguments, all as native 32-bit words, is written to the TX buffer. The
+// host decoder (see host/log_decoder.h) looks the format string up in the ELF
+// file and renders the message.
+//
+// Arguments must be integers, characters or pointers, at most
+// BUFFY_LOG_MAX_ARGS of them. %s arguments must point to constant strings that
+// the host can find in the ELF file.
+//
+// The format strings are not needed on the target. Keep them out of flash by
+// marking the section as not loaded in the linker script:
+//
+//   buffy_fmt 0 (INFO) : { KEEP(*(buffy_fmt)) }
+//
+// Don't mix BUFFY_LOG with other writes to the same buffy instance: records
+// are written whole or not at all, but the host can't tell them apart from
+// other data.
+//
+// BUFFY_LOG_LEVEL(t, level, fmt, ...) does the same with a severity level
+// (BUFFY_LEVEL_*), which is stored in the top bits of the record ID. Records
+// below the channel's tx_level are skipped before the arguments are even
+// evaluated. BUFFY_LOG logs at BUFFY_LEVEL_INFO.
+#define BUFFY_LOG_MAX_ARGS 8
+
+#define BUFFY_LOG(t, fmt, ...) \
+  BUFFY_LOG_LEVEL(t, BUFFY_LEVEL_INFO, fmt, ##__VA_ARGS__)
+
+#define BUFFY_LOG_LEVEL(t, level, fmt, ...)                          \
+  do {                                                               \
+    __attribute__((section("buffy_fmt"))) static const char          \
+        buffy_log_fmt_[] = fmt;                                      \
+    if (!BUFFY_LEVEL_ENABLED((t), (level))) break;                   \
+    const uint32_t buffy_log_args_[] = {                             \
+        0 BUFFY_LOG_ARGS_(fmt, ##__VA_ARGS__)};                      \
+    buffy_log((t),                                                   \
+              BUFFY_LOG_ID_(buffy_log_fmt_) |                        \
+                  (uint32_t)(level) << BUFFY_LOG_LEVEL_SHIFT,        \
+              buffy_log_args_ + 1,                                   \
+              sizeof(buffy_log_args_) / sizeof(uint32_t) - 1);       \
+  } while (0)
+
+// Record IDs are the format string offset in the low bits, the level above.
+#define BUFFY_LOG_LEVEL_SHIFT 29
+
+// Writes a BUFFY_LOG record. You would typically use the macro instead.
+//
+// Returns number of bytes written: the whole record, or 0 if there was no
+// space for it.
+int buffy_log(struct buffy* t, uint32_t id, const uint32_t* args, int nargs);
+
+// Start of the format string section, provided by the linker.
+extern const char __start_buffy_fmt[];
+
+#define BUFFY_LOG_ID_(fmt) \
+  ((uint32_t)((uintptr_t)(fmt) - (uintptr_t)__start_buffy_fmt))
+#define BUFFY_LOG_ARG_(x) , (uint32_t)(uintptr_t)(x)
+// Argument lists start with the format string so that the variadic part is
+// never the only argument, which keeps the ## comma elision working in
+// strict ISO modes.
+#define BUFFY_LOG_NARGS_(...) \
+  BUFFY_LOG_NARGS_IMPL_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define BUFFY_LOG_NARGS_IMPL_(f, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+#define BUFFY_LOG_CAT_(a, b) BUFFY_LOG_CAT_IMPL_(a, b)
+#define BUFFY_LOG_CAT_IMPL_(a, b) a##b
+#define BUFFY_LOG_ARGS_(...) \
+  BUFFY_LOG_CAT_(BUFFY_LOG_ARGS_, BUFFY_LOG_NARGS_(__VA_ARGS__))(__VA_ARGS__)
+#define BUFFY_LOG_ARGS_0(f)
+#define BUFFY_LOG_ARGS_1(f, a) BUFFY_LOG_ARG_(a)
+#define BUFFY_LOG_ARGS_2(f, a, ...) \
+  BUFFY_LOG_ARG_(a) BUFFY_LOG_ARGS_1(f, __VA_ARGS__)
+#define BUFFY_LOG_ARGS_3(f, a, ...) \
+  BUFFY_LOG_ARG_(a) BUFFY_LOG_ARGS_2(f, __VA_ARGS__)
+#define BUFFY_LOG_ARGS_4(f, a, ...) \
+  BUFFY_LOG_ARG_(a) BUFFY_LOG_ARGS_3(f, __VA_ARGS__)
+#define BUFFY_LOG_ARGS_5(f, a, ...) \
+  BUFFY_LOG_ARG_(a) BUFFY_LOG_ARGS_4(f, __VA_ARGS__)
+#define BUFFY_LOG_ARGS_6(f, a, ...) \
+  BUFFY_LOG_ARG_(a) BUFFY_LOG_ARGS_5(f, __VA_ARGS__)
+#define BUFFY_LOG_ARGS_7(f, a, ...) \
+  BUFFY_LOG_ARG_(a) BUFFY_LOG_ARGS_6(f, __VA_ARGS__)
+#define BUFFY_LOG_ARGS_8(f, a, ...) \
+  BUFFY_LOG_ARG_(a) BUFFY_LOG_ARGS_7(f, __VA_ARGS__)
+
 // Receive buffer: from host to embedded.
 // ======================================
 // Attempts to read from the receive buffer for up to len characters.
@@ -65,43 +402,198 @@ int buffy_tx_get_buffer_free(struct buffy* t);
 // Returns the number of characters received.
 int buffy_rx(struct buffy* t, char* buf, int len);
 
+// Returns the data waiting in the receive buffer without copying it out: span1
+// starts at the tail, span2 continues at the start of the buffer if the data
+// wraps around (span2->len is 0 otherwise). The data stays in the buffer, and
+// the host can't overwrite it, until it is released with buffy_rx_consume().
+// Parsers can use this to work on the buffer directly and only consume once
+// they have a whole message.
+//
+// Returns the number of bytes available (span1->len + span2->len).
+int buffy_rx_peek(struct buffy* t, struct buffy_span* span1,
+                  struct buffy_span* span2);
+
+// Releases the first n bytes returned by buffy_rx_peek() back to the host. n
+// must not be larger than the number of bytes it returned.
+void buffy_rx_consume(struct buffy* t, int n);
+
+// Host commands.
+// ==============
+// buffy_rx_poll() reads the RX buffer as a stream of command frames:
+//
+//   uint8_t id, uint8_t reserved (0), uint16_t len (little endian), data
+//
+// and calls the handler for each complete frame's ID. The host side is
+// Reader::SendCommand() in host/reader.h.
+#define BUFFY_COMMAND_HEADER_SIZE 4
+
+struct buffy_command {
+  uint8_t id;
+  // Called with the frame's len bytes of data. The data is only valid until
+  // the handler returns: it points into the RX buffer, and the host may
+  // overwrite it once the frame is consumed. The handler can reply with
+  // buffy_tx() on t.
+  void (*handler)(struct buffy* t, const uint8_t* data, int len);
+};
+
+// Dispatches all the complete command frames in the RX buffer to the
+// handlers in commands[0..n). Never blocks, so it can be called from the main
+// loop or a low priority task. Frames are parsed in place, only those that
+// wrap around the end of the buffer are copied (see BUFFY_COMMAND_BUF_SIZE).
+// Frames with an unknown ID are skipped. A frame that could never fit in the
+// buffer means the stream is garbled, in which case everything pending is
+// dropped.
+//
+// Returns the number of frames handed to a handler. Don't mix with
+// buffy_rx() on the same channel.
+int buffy_rx_poll(struct buffy* t, const struct buffy_command* commands,
+                  int n);
+
 // Macro to instantiate a buffy structure + rx and tx buffers.
-#define INSTANTIATE_BUFFY(name)                                 \
-  static uint8_t name##_tx_buf[BUFFY_TX_BUF_SIZE];              \
-  static uint8_t name##_rx_buf[BUFFY_RX_BUF_SIZE];              \
-  static struct buffy name = {                                  \
-      .magic = BUFFY_MAGIC,                                     \
-      .version = 1,                                             \
-      .tx_len_pow2 = 32 - 1 - __builtin_clz(BUFFY_TX_BUF_SIZE), \
-      .rx_len_pow2 = 32 - 1 - __builtin_clz(BUFFY_RX_BUF_SIZE), \
-      .tx_tail = 0,                                             \
-      .tx_head = 0,                                             \
-      .rx_tail = 0,                                             \
-      .rx_head = 0,                                             \
-      .tx_overflow_counter = 0,                                 \
-      .version = 1,                                             \
-      .tx_buf = name##_tx_buf,                                  \
-      .rx_buf = name##_rx_buf,                                  \
-  };
+#define INSTANTIATE_BUFFY(name)                                          \
+  BUFFY_BUFFERS_(name, BUFFY_TX_BUF_SIZE, BUFFY_RX_BUF_SIZE);            \
+  static struct buffy name =                                             \
+      BUFFY_INITIALIZER_(name, BUFFY_TX_BUF_SIZE, BUFFY_RX_BUF_SIZE, 0);
 
 // Macro to instantiate structure and buffers, placing the structure in
 // a particular linker section.
 //
 // This might be useful to place the buffy struct before other .data. That way,
 // it will always end up at same address, making it easier to find.
-#define INSTANTIATE_BUFFY_IN_SECTION(name, linker_section)              \
-  static uint8_t name##_tx_buf[BUFFY_TX_BUF_SIZE];                      \
-  static uint8_t name##_rx_buf[BUFFY_RX_BUF_SIZE];                      \
-  __attribute__((section(linker_section))) static struct buffy name = { \
-      .magic = BUFFY_MAGIC,                                             \
-      .version = 1,                                                     \
-      .tx_len_pow2 = 32 - 1 - __builtin_clz(BUFFY_TX_BUF_SIZE),         \
-      .rx_len_pow2 = 32 - 1 - __builtin_clz(BUFFY_RX_BUF_SIZE),         \
-      .tx_tail = 0,                                                     \
-      .tx_head = 0,                                                     \
-      .rx_tail = 0,                                                     \
-      .rx_head = 0,                                                     \
-      .tx_overflow_counter = 0,                                         \
-      .tx_buf = name##_tx_buf,                                          \
-      .rx_buf = name##_rx_buf,                                          \
-  };
+#define INSTANTIATE_BUFFY_IN_SECTION(name, linker_section)               \
+  BUFFY_BUFFERS_(name, BUFFY_TX_BUF_SIZE, BUFFY_RX_BUF_SIZE);            \
+  __attribute__((section(linker_section))) static struct buffy name =    \
+      BUFFY_INITIALIZER_(name, BUFFY_TX_BUF_SIZE, BUFFY_RX_BUF_SIZE, 0);
+
+// Macro to instantiate a buffy structure with its own buffer sizes (powers of
+// 2), e.g. for channels that need more or less space than the default.
+#define INSTANTIATE_BUFFY_SIZED(name, tx_size, rx_size)                     \
+  BUFFY_BUFFERS_(name, tx_size, rx_size);                                   \
+  static struct buffy name = BUFFY_INITIALIZER_(name, tx_size, rx_size, 0);
+
+// Macro to instantiate the root descriptor for a list of channels, each given
+// as BUFFY_CHANNEL(name) of an instantiated buffy structure:
+//
+//   INSTANTIATE_BUFFY_SIZED(radio, 1024, 64);
+//   INSTANTIATE_BUFFY(power);
+//   INSTANTIATE_BUFFY_ROOT(buffy_root, BUFFY_CHANNEL(radio),
+//                          BUFFY_CHANNEL(power));
+//
+// Only the debugger reads the root, so it is marked used to keep the compiler
+// from warning about it and dropping it.
+#define INSTANTIATE_BUFFY_ROOT(name, ...)               \
+  __attribute__((used)) static struct buffy_root name = \
+      BUFFY_ROOT_INITIALIZER_(__VA_ARGS__);
+
+// Same as above, placing the root descriptor in a particular linker section.
+#define INSTANTIATE_BUFFY_ROOT_IN_SECTION(name, linker_section, ...)      \
+  __attribute__((used, section(linker_section))) static struct buffy_root \
+      name = BUFFY_ROOT_INITIALIZER_(__VA_ARGS__);
+
+#define BUFFY_CHANNEL(channel) \
+  { .name = #channel, .buffy = &channel }
+
+// Macro to instantiate one buffy structure per core for SMP targets (e.g.
+// Cortex-M7 + M4, RP2040), as name[0..ncpus), along with a root descriptor
+// name_root that lists them as channels "cpu0", "cpu1", ... ncpus is a literal
+// from 1 to 4.
+//
+// Each core writes only to its own ring, buffy_tx(&name[core_id], ...), so the
+// cores never synchronize with each other. To let the host merge the rings
+// into one stream (host/record_merger.h), write buffy_tx_timestamped() records
+// with a tick source shared by all cores, e.g. a system timer rather than each
+// core's own DWT cycle counter.
+#define INSTANTIATE_BUFFY_PERCPU(name, ncpus)                        \
+  static uint8_t name##_tx_buf[ncpus][BUFFY_TX_BUF_SIZE];           \
+  static uint8_t name##_rx_buf[ncpus][BUFFY_RX_BUF_SIZE];           \
+  static struct buffy name[ncpus] = {                               \
+      BUFFY_PERCPU_##ncpus##_(BUFFY_PERCPU_INITIALIZER_, name)};    \
+  __attribute__((used)) static struct buffy_root name##_root =      \
+      BUFFY_ROOT_INITIALIZER_(                                      \
+          BUFFY_PERCPU_##ncpus##_(BUFFY_PERCPU_CHANNEL_, name));
+
+// Macro to instantiate a buffy structure + buffers in flight recorder mode
+// (see BUFFY_FLAG_OVERWRITE). Fails to build with BUFFY_MULTI_PRODUCER, which
+// doesn't support it.
+#if BUFFY_MULTI_PRODUCER
+#ifdef __cplusplus
+#define BUFFY_STATIC_ASSERT_(cond, msg) static_assert(cond, msg)
+#else
+#define BUFFY_STATIC_ASSERT_(cond, msg) _Static_assert(cond, msg)
+#endif
+#define INSTANTIATE_BUFFY_FLIGHT_RECORDER(name)                         \
+  BUFFY_STATIC_ASSERT_(0, "flight recorder mode is not supported with " \
+                          "BUFFY_MULTI_PRODUCER")
+#else
+#define INSTANTIATE_BUFFY_FLIGHT_RECORDER(name)                          \
+  BUFFY_BUFFERS_(name, BUFFY_TX_BUF_SIZE, BUFFY_RX_BUF_SIZE);            \
+  static struct buffy name = BUFFY_INITIALIZER_(                         \
+      name, BUFFY_TX_BUF_SIZE, BUFFY_RX_BUF_SIZE, BUFFY_FLAG_OVERWRITE);
+#endif
+
+// Helpers for the macros above.
+#define BUFFY_BUFFERS_(name, tx_size, rx_size) \
+  static uint8_t name##_tx_buf[tx_size];       \
+  static uint8_t name##_rx_buf[rx_size]
+
+#define BUFFY_INITIALIZER_(name, tx_size, rx_size, buffy_flags)           \
+  BUFFY_BUFFERS_INITIALIZER_(name##_tx_buf, name##_rx_buf, tx_size, rx_size, \
+                             buffy_flags)
+
+#define BUFFY_BUFFERS_INITIALIZER_(tx, rx, tx_size, rx_size, buffy_flags) \
+  {                                                                       \
+      .magic = BUFFY_MAGIC,                                               \
+      .version = BUFFY_VERSION,                                           \
+      .tx_len_pow2 = 32 - 1 - __builtin_clz(tx_size),                     \
+      .rx_len_pow2 = 32 - 1 - __builtin_clz(rx_size),                     \
+      .flags = (buffy_flags),                                             \
+      .tx_tail = 0,                                                       \
+      .tx_head = 0,                                                       \
+      .rx_tail = 0,                                                       \
+      .rx_head = 0,                                                       \
+      .tx_overflow_counter = 0,                                           \
+      .tx_buf = (tx),                                                     \
+      .rx_buf = (rx),                                                     \
+      .tx_reserve = 0,                                                    \
+      .tx_writers = 0,                                                    \
+      .tx_records = 0,                                                    \
+      .tx_dropped_bytes = 0,                                              \
+      .tx_dropped_records = 0,                                            \
+      .tx_last_tick = 0,                                                  \
+      .tx_sync_countdown = 0,                                             \
+      .tx_level = 0,                                                      \
+      .tx_tick_hook = 0,                                                  \
+      .tx_wait_hook = 0,                                                  \
+      .tx_wait_limit = 0,                                                 \
+      .tx_stalled_tail = 0,                                               \
+  }
+
+#define BUFFY_PERCPU_INITIALIZER_(instance, cpu)                      \
+  BUFFY_BUFFERS_INITIALIZER_(instance##_tx_buf[cpu],                  \
+                             instance##_rx_buf[cpu], BUFFY_TX_BUF_SIZE, \
+                             BUFFY_RX_BUF_SIZE, 0)
+
+#define BUFFY_PERCPU_CHANNEL_(instance, cpu) \
+  { .name = "cpu" #cpu, .buffy = &instance[cpu] }
+
+#define BUFFY_PERCPU_1_(m, instance) m(instance, 0)
+#define BUFFY_PERCPU_2_(m, instance) \
+  BUFFY_PERCPU_1_(m, instance), m(instance, 1)
+#define BUFFY_PERCPU_3_(m, instance) \
+  BUFFY_PERCPU_2_(m, instance), m(instance, 2)
+#define BUFFY_PERCPU_4_(m, instance) \
+  BUFFY_PERCPU_3_(m, instance), m(instance, 3)
+
+#define BUFFY_ROOT_INITIALIZER_(...)                                   \
+  {                                                                    \
+      .magic = BUFFY_ROOT_MAGIC,                                       \
+      .version = BUFFY_ROOT_VERSION,                                   \
+      .channel_count = sizeof((struct buffy_channel[]){__VA_ARGS__}) / \
+                       sizeof(struct buffy_channel),                   \
+      .reserved = {0, 0},                                              \
+      .channels = {__VA_ARGS__},                                       \
+  }
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Layout of struct buffy and struct buffy_root as seen from the host, see
+// embedded/buffy.h. Targets are 32-bit little-endian.
+
+namespace buffy_host {
+
+constexpr uint32_t kBuffyMagic = 0xdd664642;
+constexpr uint32_t kBuffyRootMagic = 0xdd664652;
+constexpr uint8_t kFlagOverwrite = 0x01;
+constexpr size_t kRecordHeaderSize = 2;
+
+// Field offsets in struct buffy.
+constexpr uint32_t kMagicOffset = 0;
+constexpr uint32_t kVersionOffset = 4;
+constexpr uint32_t kTxTailOffset = 8;
+constexpr uint32_t kTxHeadOffset = 12;
+constexpr uint32_t kRxTailOffset = 16;
+constexpr uint32_t kRxHeadOffset = 20;
+constexpr uint32_t kTxOverflowCounterOffset = 24;
+constexpr uint32_t kTxBufOffset = 28;
+constexpr uint32_t kRxBufOffset = 32;
+// Everything the host needs, the rest of the structure is target-only state.
+constexpr size_t kHeaderSize = 36;
+// Record count in flight recorder mode, read along with the header there.
+constexpr uint32_t kTxRecordsOffset = 44;
+constexpr size_t kFlightRecorderHeaderSize = 48;
+// Drop statistics past the header, read separately when needed.
+constexpr uint32_t kTxDroppedBytesOffset = 48;
+constexpr uint32_t kTxDroppedRecordsOffset = 52;
+// Host-writable severity threshold.
+constexpr uint32_t kTxLevelOffset = 64;
+
+// Command frames for buffy_rx_poll(): id, reserved, 16-bit length.
+constexpr size_t kCommandHeaderSize = 4;
+
+// BUFFY_LOG record IDs: format string offset below, severity level above.
+constexpr int kLogLevelShift = 29;
+
+// Root descriptor: header followed by the channel table.
+constexpr size_t kRootHeaderSize = 8;
+constexpr size_t kChannelNameLen = 12;
+constexpr size_t kChannelSize = kChannelNameLen + 4;
+
+inline uint32_t ReadLe32(const uint8_t* p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+// Decoded struct buffy header.
+struct BuffyHeader {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t tx_len_pow2;
+  uint8_t rx_len_pow2;
+  uint8_t flags;
+  uint32_t tx_tail;
+  uint32_t tx_head;
+  uint32_t rx_tail;
+  uint32_t rx_head;
+  uint32_t tx_overflow_counter;
+  uint32_t tx_buf;
+  uint32_t rx_buf;
+  uint32_t tx_records;  // 0 unless parsed from kFlightRecorderHeaderSize.
+
+  // Parses kHeaderSize bytes, or kFlightRecorderHeaderSize to include
+  // tx_records.
+  static BuffyHeader Parse(const uint8_t* data, size_t len = kHeaderSize) {
+    BuffyHeader h;
+    h.magic = ReadLe32(data + kMagicOffset);
+    h.version = data[kVersionOffset];
+    h.tx_len_pow2 = data[5];
+    h.rx_len_pow2 = data[6];
+    // Byte 7 was the 'initialized' flag in version 1.
+    h.flags = h.version >= 2 ? data[7] : 0;
+    h.tx_tail = ReadLe32(data + kTxTailOffset);
+    h.tx_head = ReadLe32(data + kTxHeadOffset);
+    h.rx_tail = ReadLe32(data + kRxTailOffset);
+    h.rx_head = ReadLe32(data + kRxHeadOffset);
+    h.tx_overflow_counter = ReadLe32(data + kTxOverflowCounterOffset);
+    h.tx_buf = ReadLe32(data + kTxBufOffset);
+    h.rx_buf = ReadLe32(data + kRxBufOffset);
+    h.tx_records = len >= kFlightRecorderHeaderSize
+                       ? ReadLe32(data + kTxRecordsOffset)
+                       : 0;
+    return h;
+  }
+
+  uint32_t tx_size() const { return 1u << tx_len_pow2; }
+  uint32_t rx_size() const { return 1u << rx_len_pow2; }
+};
+
+}  // namespace buffy_host
@@ -0,0 +1,106 @@
+#include "elf_file.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace buffy_host {
+
+namespace {
+
+constexpr uint32_t kShtNobits = 8;
+constexpr uint32_t kShfAlloc = 2;
+constexpr size_t kSectionHeaderSize = 40;
+
+uint16_t Read16(const std::string& image, size_t offset) {
+  return static_cast<uint8_t>(image[offset]) |
+         static_cast<uint8_t>(image[offset + 1]) << 8;
+}
+
+uint32_t Read32(const std::string& image, size_t offset) {
+  return Read16(image, offset) |
+         static_cast<uint32_t>(Read16(image, offset + 2)) << 16;
+}
+
+}  // namespace
+
+bool ElfFile::Load(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return Fail("can't open " + path);
+  std::stringstream image;
+  image << file.rdbuf();
+  return Parse(image.str());
+}
+
+bool ElfFile::Parse(const std::string& image) {
+  sections_.clear();
+  if (image.size() < 52 || image.compare(0, 4, "\x7f" "ELF") != 0) {
+    return Fail("not an ELF file");
+  }
+  if (image[4] != 1 || image[5] != 1) {
+    return Fail("not a 32-bit little-endian ELF file");
+  }
+  uint32_t shoff = Read32(image, 0x20);
+  uint16_t shentsize = Read16(image, 0x2e);
+  uint16_t shnum = Read16(image, 0x30);
+  uint16_t shstrndx = Read16(image, 0x32);
+  if (shentsize < kSectionHeaderSize || shstrndx >= shnum ||
+      shoff + static_cast<uint64_t>(shnum) * shentsize > image.size()) {
+    return Fail("bad section header table");
+  }
+
+  std::vector<uint32_t> name_offsets;
+  for (uint16_t i = 0; i < shnum; i++) {
+    size_t header = shoff + i * shentsize;
+    Section section;
+    section.type = Read32(image, header + 4);
+    section.flags = Read32(image, header + 8);
+    section.addr = Read32(image, header + 12);
+    uint32_t offset = Read32(image, header + 16);
+    uint32_t size = Read32(image, header + 20);
+    if (section.type != kShtNobits) {
+      if (static_cast<uint64_t>(offset) + size > image.size()) {
+        return Fail("section data out of bounds");
+      }
+      section.data = image.substr(offset, size);
+    }
+    name_offsets.push_back(Read32(image, header));
+    sections_.push_back(std::move(section));
+  }
+
+  const std::string& names = sections_[shstrndx].data;
+  for (size_t i = 0; i < sections_.size(); i++) {
+    if (name_offsets[i] < names.size()) {
+      sections_[i].name = names.c_str() + name_offsets[i];
+    }
+  }
+  return true;
+}
+
+const ElfFile::Section* ElfFile::FindSection(const std::string& name) const {
+  for (const Section& section : sections_) {
+    if (section.name == name) return &section;
+  }
+  return nullptr;
+}
+
+bool ElfFile::ReadString(uint32_t addr, std::string* out) const {
+  for (const Section& section : sections_) {
+    if (!(section.flags & kShfAlloc) || addr < section.addr ||
+        addr - section.addr >= section.data.size()) {
+      continue;
+    }
+    size_t start = addr - section.addr;
+    size_t end = section.data.find('\0', start);
+    if (end == std::string::npos) end = section.data.size();
+    *out = section.data.substr(start, end - start);
+    return true;
+  }
+  return false;
+}
+
+bool ElfFile::Fail(const std::string& error) {
+  error_ = error;
+  return false;
+}
+
+}  // namespace buffy_host
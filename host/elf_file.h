@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace buffy_host {
+
+// Minimal reader for 32-bit little-endian ELF files, enough to look up the
+// sections of a firmware image.
+class ElfFile {
+ public:
+  struct Section {
+    std::string name;
+    uint32_t type;
+    uint32_t flags;
+    uint32_t addr;
+    std::string data;  // Empty for sections without file contents (.bss).
+  };
+
+  // Reads and parses an ELF file. Returns false on errors, see error().
+  bool Load(const std::string& path);
+
+  // Parses an ELF image that is already in memory.
+  bool Parse(const std::string& image);
+
+  // Returns the section with the given name, or nullptr.
+  const Section* FindSection(const std::string& name) const;
+
+  // Reads the NUL-terminated string at a target address from the loaded
+  // sections. Returns false if the address isn't in any of them.
+  bool ReadString(uint32_t addr, std::string* out) const;
+
+  const std::vector<Section>& sections() const { return sections_; }
+  const std::string& error() const { return error_; }
+
+ private:
+  bool Fail(const std::string& error);
+
+  std::vector<Section> sections_;
+  std::string error_;
+};
+
+}  // namespace buffy_host
@@ -0,0 +1,64 @@
+#include "frame_decoder.h"
+
+#include <string.h>
+
+namespace buffy_host {
+
+void FrameDecoder::Feed(const uint8_t* data, size_t len) {
+  const uint8_t* end = data + len;
+  while (data < end) {
+    const uint8_t* delimiter =
+        static_cast<const uint8_t*>(memchr(data, 0, end - data));
+    if (!synced_) {
+      if (!delimiter) {
+        skipped_bytes_ += end - data;
+        return;
+      }
+      skipped_bytes_ += delimiter + 1 - data;
+      data = delimiter + 1;
+      synced_ = true;
+      continue;
+    }
+    if (!delimiter) {
+      pending_.insert(pending_.end(), data, end);
+      return;
+    }
+    pending_.insert(pending_.end(), data, delimiter);
+    data = delimiter + 1;
+    Deliver();
+  }
+}
+
+void FrameDecoder::Reset() {
+  skipped_bytes_ += pending_.size();
+  pending_.clear();
+  synced_ = false;
+}
+
+void FrameDecoder::Deliver() {
+  decoded_.clear();
+  size_t pos = 0;
+  bool ok = !pending_.empty();
+  while (ok && pos < pending_.size()) {
+    uint8_t code = pending_[pos++];
+    if (code - 1u > pending_.size() - pos) {
+      ok = false;
+      break;
+    }
+    decoded_.insert(decoded_.end(), pending_.begin() + pos,
+                    pending_.begin() + pos + code - 1);
+    pos += code - 1;
+    // Blocks shorter than the maximum stand for a zero byte, except for the
+    // last one.
+    if (code != 0xff && pos < pending_.size()) decoded_.push_back(0);
+  }
+  pending_.clear();
+  if (!ok) {
+    bad_frames_++;
+    return;
+  }
+  frames_++;
+  if (callback_) callback_(decoded_.data(), decoded_.size());
+}
+
+}  // namespace buffy_host
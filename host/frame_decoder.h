@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+namespace buffy_host {
+
+// Decodes the COBS frames written by buffy_tx_frame().
+//
+// Frames are terminated by a zero byte and contain no other zero bytes, so
+// after losing data the decoder only has to skip to the next zero byte to be
+// back in sync.
+class FrameDecoder {
+ public:
+  using FrameCallback = std::function<void(const uint8_t* data, size_t len)>;
+
+  void SetFrameCallback(FrameCallback callback) {
+    callback_ = std::move(callback);
+  }
+
+  // Feeds bytes read out of the TX buffer. Calls the frame callback for every
+  // complete frame, partial frames are kept until more data arrives.
+  void Feed(const uint8_t* data, size_t len);
+
+  // Tells the decoder that data was lost (e.g. Reader::lost_bytes() went up
+  // or the reader was restarted). The partial frame is dropped, and so is
+  // everything up to the next delimiter.
+  void Reset();
+
+  // Number of frames delivered.
+  uint64_t frames() const { return frames_; }
+  // Number of frames that failed to decode, and bytes dropped while getting
+  // back in sync.
+  uint64_t bad_frames() const { return bad_frames_; }
+  uint64_t skipped_bytes() const { return skipped_bytes_; }
+
+ private:
+  // Decodes the frame in pending_ and hands it out.
+  void Deliver();
+
+  FrameCallback callback_;
+  std::vector<uint8_t> pending_;
+  std::vector<uint8_t> decoded_;
+  bool synced_ = true;
+  uint64_t frames_ = 0;
+  uint64_t bad_frames_ = 0;
+  uint64_t skipped_bytes_ = 0;
+};
+
+}  // namespace buffy_host
@@ -0,0 +1,239 @@
+#include "gdb_remote.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "tcp.h"
+
+namespace buffy_host {
+
+namespace {
+
+// What GDB assumes when the stub doesn't report PacketSize.
+constexpr size_t kDefaultPacketSize = 400;
+// Room for "Maaaaaaaa,llllllll:" in front of the data of an M packet.
+constexpr size_t kWriteHeaderSize = 20;
+
+int HexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+}  // namespace
+
+GdbRemote::~GdbRemote() {
+  Close();
+}
+
+bool GdbRemote::Connect(const std::string& host, int port) {
+  Close();
+  std::string error;
+  fd_ = TcpConnect(host, port, &error);
+  if (fd_ < 0) return Fail(error);
+
+  acks_ = true;
+  non_stop_ = false;
+  packet_size_ = kDefaultPacketSize;
+  // GDB opens with an ack too, some stubs wait for it.
+  if (!Send("+")) return false;
+
+  std::string reply;
+  if (!Command("qSupported", &reply)) return false;
+  bool no_ack_mode = false;
+  size_t start = 0;
+  while (start < reply.size()) {
+    size_t end = std::min(reply.find(';', start), reply.size());
+    std::string feature = reply.substr(start, end - start);
+    if (feature.compare(0, 11, "PacketSize=") == 0) {
+      packet_size_ = strtoul(feature.c_str() + 11, nullptr, 16);
+    } else if (feature == "QStartNoAckMode+") {
+      no_ack_mode = true;
+    }
+    start = end + 1;
+  }
+  // Too small to make progress with.
+  if (packet_size_ < 2 * kWriteHeaderSize) packet_size_ = kDefaultPacketSize;
+
+  // Over TCP, acks are only extra latency.
+  if (no_ack_mode) {
+    if (!Command("QStartNoAckMode", &reply)) return false;
+    if (reply == "OK") acks_ = false;
+  }
+  if (!Command("QNonStop:1", &reply)) return false;
+  non_stop_ = reply == "OK";
+  return true;
+}
+
+void GdbRemote::Close() {
+  if (fd_ >= 0) close(fd_);
+  fd_ = -1;
+  buffer_.clear();
+  buffer_pos_ = 0;
+}
+
+bool GdbRemote::Command(const std::string& packet, std::string* reply) {
+  if (fd_ < 0) return Fail("not connected");
+  round_trips_++;
+  if (!SendPacket(packet)) return false;
+  char kind;
+  // Stop notifications in non-stop mode would need a vStopped exchange to
+  // get the next one, but only memory access is used here, so they are
+  // dropped.
+  do {
+    if (!ReceivePacket(&kind, reply)) return false;
+  } while (kind == '%');
+  return true;
+}
+
+bool GdbRemote::ReadMemory(uint32_t addr, uint8_t* buf, size_t len) {
+  size_t max_len = packet_size_ / 2;
+  while (len > 0) {
+    size_t n = std::min(len, max_len);
+    char packet[32];
+    snprintf(packet, sizeof(packet), "m%x,%zx", addr, n);
+    std::string reply;
+    if (!Command(packet, &reply)) return false;
+    // Data is always an even number of digits, errors are "Exx".
+    if (reply.empty() || reply.size() % 2 != 0 || reply.size() > 2 * n) {
+      return Fail("read failed: " + reply);
+    }
+    // Stubs may return less than asked for.
+    n = reply.size() / 2;
+    for (size_t i = 0; i < n; i++) {
+      int hi = HexDigit(reply[2 * i]);
+      int lo = HexDigit(reply[2 * i + 1]);
+      if (hi < 0 || lo < 0) return Fail("bad reply: " + reply);
+      buf[i] = hi << 4 | lo;
+    }
+    addr += n;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool GdbRemote::WriteMemory(uint32_t addr, const uint8_t* buf, size_t len) {
+  static const char kDigits[] = "0123456789abcdef";
+  size_t max_len = (packet_size_ - kWriteHeaderSize) / 2;
+  while (len > 0) {
+    size_t n = std::min(len, max_len);
+    char header[32];
+    snprintf(header, sizeof(header), "M%x,%zx:", addr, n);
+    std::string packet = header;
+    for (size_t i = 0; i < n; i++) {
+      packet += kDigits[buf[i] >> 4];
+      packet += kDigits[buf[i] & 0xf];
+    }
+    std::string reply;
+    if (!Command(packet, &reply)) return false;
+    if (reply != "OK") return Fail("write failed: " + reply);
+    addr += n;
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool GdbRemote::Send(const std::string& data) {
+  for (size_t sent = 0; sent < data.size();) {
+    ssize_t n = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      Close();
+      return Fail("send failed");
+    }
+    sent += n;
+  }
+  return true;
+}
+
+bool GdbRemote::SendPacket(const std::string& payload) {
+  uint8_t checksum = 0;
+  for (char c : payload) checksum += c;
+  char trailer[4];
+  snprintf(trailer, sizeof(trailer), "#%02x", checksum);
+  std::string packet = "$" + payload + trailer;
+  for (int attempt = 0; attempt < 3; attempt++) {
+    if (!Send(packet)) return false;
+    if (!acks_) return true;
+    char c;
+    do {
+      if (!ReceiveChar(&c)) return false;
+    } while (c != '+' && c != '-');
+    if (c == '+') return true;
+  }
+  return Fail("packet not acknowledged");
+}
+
+bool GdbRemote::ReceivePacket(char* kind, std::string* payload) {
+  while (true) {
+    char c;
+    do {
+      if (!ReceiveChar(&c)) return false;
+    } while (c != '$' && c != '%');
+    *kind = c;
+    payload->clear();
+    uint8_t checksum = 0;
+    while (true) {
+      if (!ReceiveChar(&c)) return false;
+      if (c == '#') break;
+      checksum += c;
+      // Run-length encoding: the previous character repeated, the count is
+      // the next character minus 29. The count is printable and can't be
+      // '#' or '$'. Anything else means the stream is out of step, so give
+      // up on the connection.
+      if (c == '*') {
+        char count;
+        if (!ReceiveChar(&count)) return false;
+        if (payload->empty() || count < 29 || count > 126 || count == '#' ||
+            count == '$') {
+          Close();
+          return Fail("bad run-length encoding");
+        }
+        checksum += count;
+        payload->append(count - 29, payload->back());
+      } else {
+        *payload += c;
+      }
+    }
+    char digits[2];
+    if (!ReceiveChar(&digits[0]) || !ReceiveChar(&digits[1])) return false;
+    int hi = HexDigit(digits[0]);
+    int lo = HexDigit(digits[1]);
+    bool ok = hi >= 0 && lo >= 0 && (hi << 4 | lo) == checksum;
+    // Notifications are never acknowledged.
+    if (!acks_ || *kind == '%') {
+      if (ok) return true;
+      return Fail("bad checksum");
+    }
+    if (!Send(ok ? "+" : "-")) return false;
+    if (ok) return true;
+  }
+}
+
+bool GdbRemote::ReceiveChar(char* c) {
+  if (buffer_pos_ == buffer_.size()) {
+    char buf[4096];
+    ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      Close();
+      return Fail("connection closed");
+    }
+    buffer_.assign(buf, n);
+    buffer_pos_ = 0;
+  }
+  *c = buffer_[buffer_pos_++];
+  return true;
+}
+
+bool GdbRemote::Fail(const std::string& error) {
+  error_ = error;
+  return false;
+}
+
+}  // namespace buffy_host
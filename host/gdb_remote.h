@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "target_memory.h"
+
+namespace buffy_host {
+
+// Target memory access through a GDB server (gdbserver, pyOCD, J-Link GDB
+// server, QEMU's gdbstub) with the remote serial protocol's m and M packets.
+//
+// Connect() negotiates the stub's packet size with qSupported, so that reads
+// and writes take as few packets as possible, turns off acks if the stub
+// supports QStartNoAckMode, and asks for non-stop mode, in which memory can
+// be accessed while the target runs. Stubs without non-stop mode only answer
+// while the target is halted, see non_stop().
+//
+// There is no scripting on the other end, so a Reader poll is separate
+// requests for the header, the data and the tail.
+class GdbRemote : public TargetMemory {
+ public:
+  GdbRemote() = default;
+  ~GdbRemote() override;
+  GdbRemote(const GdbRemote&) = delete;
+  GdbRemote& operator=(const GdbRemote&) = delete;
+
+  // Connects to the GDB server. Returns false on errors, see error().
+  bool Connect(const std::string& host, int port);
+  void Close();
+
+  // Sends a packet and waits for the reply, skipping notifications.
+  bool Command(const std::string& packet, std::string* reply);
+
+  bool ReadMemory(uint32_t addr, uint8_t* buf, size_t len) override;
+  bool WriteMemory(uint32_t addr, const uint8_t* buf, size_t len) override;
+
+  // Negotiated with the stub on connect.
+  size_t packet_size() const { return packet_size_; }
+  bool non_stop() const { return non_stop_; }
+
+  // Packets sent so far, each of which is one round trip.
+  uint64_t round_trips() const { return round_trips_; }
+  const std::string& error() const { return error_; }
+
+ private:
+  bool Send(const std::string& data);
+  bool SendPacket(const std::string& payload);
+  // Receives the next packet or notification ('$' or '%'), without the
+  // framing and with run-length encoding expanded.
+  bool ReceivePacket(char* kind, std::string* payload);
+  bool ReceiveChar(char* c);
+  // Records the error and returns false.
+  bool Fail(const std::string& error);
+
+  int fd_ = -1;
+  // Received data, consumed up to buffer_pos_.
+  std::string buffer_;
+  size_t buffer_pos_ = 0;
+  bool acks_ = true;
+  bool non_stop_ = false;
+  size_t packet_size_ = 0;
+  uint64_t round_trips_ = 0;
+  std::string error_;
+};
+
+}  // namespace buffy_host
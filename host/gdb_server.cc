@@ -0,0 +1,148 @@
+#include "gdb_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace buffy_host {
+
+namespace {
+
+std::string Frame(const std::string& payload) {
+  uint8_t checksum = 0;
+  for (char c : payload) checksum += c;
+  char trailer[4];
+  snprintf(trailer, sizeof(trailer), "#%02x", checksum);
+  return "$" + payload + trailer;
+}
+
+// Parses "addr,len" followed by 'end'. Returns the position after it.
+bool ParseAddrLen(const std::string& args, char end, uint32_t* addr,
+                  size_t* len, size_t* next) {
+  char* p;
+  *addr = strtoul(args.c_str(), &p, 16);
+  if (p == args.c_str() || *p != ',') return false;
+  const char* start = p + 1;
+  *len = strtoul(start, &p, 16);
+  if (p == start || *p != end) return false;
+  *next = p - args.c_str() + (end ? 1 : 0);
+  return true;
+}
+
+}  // namespace
+
+GdbServer::GdbServer(TargetMemory* memory, const Options& options)
+    : memory_(memory),
+      options_(options),
+      server_([this](int fd) { ServeClient(fd); }) {}
+
+GdbServer::~GdbServer() {
+  Stop();
+}
+
+void GdbServer::ServeClient(int fd) {
+  acks_ = true;
+  start_no_ack_ = false;
+  std::string pending;
+  char buf[4096];
+  ssize_t n;
+  while (!server_.stopping() && (n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+    pending.append(buf, n);
+    while (true) {
+      // Acks from the client, and anything else between packets, are
+      // skipped.
+      size_t start = pending.find('$');
+      if (start == std::string::npos) {
+        pending.clear();
+        break;
+      }
+      size_t end = pending.find('#', start);
+      if (end == std::string::npos || pending.size() < end + 3) {
+        pending.erase(0, start);
+        break;
+      }
+      std::string packet = pending.substr(start + 1, end - start - 1);
+      uint8_t checksum = 0;
+      for (char c : packet) checksum += c;
+      bool ok = strtoul(pending.substr(end + 1, 2).c_str(), nullptr, 16) ==
+                checksum;
+      pending.erase(0, end + 3);
+      std::string reply;
+      if (acks_) reply = ok ? "+" : "-";
+      if (ok) {
+        delay_bytes_ = 0;
+        reply += Frame(Execute(packet));
+        Delay(delay_bytes_);
+      }
+      if (start_no_ack_) acks_ = false;
+      if (send(fd, reply.data(), reply.size(), MSG_NOSIGNAL) < 0) return;
+    }
+  }
+}
+
+std::string GdbServer::Execute(const std::string& packet) {
+  packets_++;
+  if (packet.compare(0, 10, "qSupported") == 0) {
+    char reply[64];
+    snprintf(reply, sizeof(reply), "PacketSize=%zx;QStartNoAckMode+",
+             options_.packet_size);
+    return reply;
+  }
+  if (packet == "QStartNoAckMode") {
+    start_no_ack_ = true;
+    return "OK";
+  }
+  if (packet == "QNonStop:1") return options_.non_stop ? "OK" : "E01";
+  if (packet == "QNonStop:0") return "OK";
+  if (packet[0] == 'm') return ReadMemory(packet.substr(1));
+  if (packet[0] == 'M') return WriteMemory(packet.substr(1));
+  return "";
+}
+
+std::string GdbServer::ReadMemory(const std::string& args) {
+  uint32_t addr;
+  size_t len, next;
+  if (!ParseAddrLen(args, '\0', &addr, &len, &next)) return "E01";
+  len = std::min(len, options_.packet_size / 2);
+  std::vector<uint8_t> buf(len);
+  if (!memory_->ReadMemory(addr, buf.data(), len)) return "E01";
+  delay_bytes_ += len;
+  target_bytes_ += len;
+  static const char kDigits[] = "0123456789abcdef";
+  std::string reply;
+  for (uint8_t b : buf) {
+    reply += kDigits[b >> 4];
+    reply += kDigits[b & 0xf];
+  }
+  return reply;
+}
+
+std::string GdbServer::WriteMemory(const std::string& args) {
+  uint32_t addr;
+  size_t len, next;
+  if (!ParseAddrLen(args, ':', &addr, &len, &next)) return "E01";
+  if (args.size() - next != 2 * len) return "E01";
+  std::vector<uint8_t> buf(len);
+  for (size_t i = 0; i < len; i++) {
+    buf[i] = strtoul(args.substr(next + 2 * i, 2).c_str(), nullptr, 16);
+  }
+  if (!memory_->WriteMemory(addr, buf.data(), len)) return "E01";
+  delay_bytes_ += len;
+  target_bytes_ += len;
+  return "OK";
+}
+
+void GdbServer::Delay(size_t bytes) {
+  std::chrono::duration<double> delay = options_.latency;
+  if (options_.bandwidth > 0) {
+    delay += std::chrono::duration<double>(bytes / options_.bandwidth);
+  }
+  if (delay.count() > 0) std::this_thread::sleep_for(delay);
+}
+
+}  // namespace buffy_host
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "target_memory.h"
+#include "tcp.h"
+
+namespace buffy_host {
+
+// Stand-in for a GDB server, for benchmarks and tests without hardware or
+// an emulator. Serves target memory to one client at a time over the remote
+// serial protocol, like TclServer does for OpenOCD's TCL port.
+//
+// Only understands what GdbRemote sends: qSupported, QStartNoAckMode,
+// QNonStop, and m and M packets. Everything else gets an empty reply, which
+// means unsupported. Every packet can be slowed down to model the debug
+// adapter.
+class GdbServer {
+ public:
+  struct Options {
+    // Added to every packet.
+    std::chrono::microseconds latency = std::chrono::microseconds(0);
+    // Bytes per second for the target memory a packet reads or writes, 0
+    // for no limit.
+    double bandwidth = 0;
+    // Reported in qSupported. Longer reads return less than asked for.
+    size_t packet_size = 0x4000;
+    // Whether QNonStop:1 succeeds.
+    bool non_stop = true;
+  };
+
+  // The memory must outlive the server.
+  GdbServer(TargetMemory* memory, const Options& options);
+  explicit GdbServer(TargetMemory* memory) : GdbServer(memory, Options()) {}
+  ~GdbServer();
+  GdbServer(const GdbServer&) = delete;
+  GdbServer& operator=(const GdbServer&) = delete;
+
+  // Starts serving on a loopback port, 0 picks a free one. Returns false on
+  // errors.
+  bool Start(int port = 0) { return server_.Start(port); }
+  void Stop() { server_.Stop(); }
+  int port() const { return server_.port(); }
+
+  // Runs a single packet (without framing) and returns the reply.
+  std::string Execute(const std::string& packet);
+
+  uint64_t packets() const { return packets_; }
+  uint64_t target_bytes() const { return target_bytes_; }
+
+ private:
+  void ServeClient(int fd);
+  std::string ReadMemory(const std::string& args);
+  std::string WriteMemory(const std::string& args);
+  // Sleeps for the modelled time of a packet that moved 'bytes' bytes of
+  // target memory.
+  void Delay(size_t bytes);
+
+  TargetMemory* memory_;
+  Options options_;
+  bool acks_ = true;
+  bool start_no_ack_ = false;  // Acks stop after the current reply.
+  size_t delay_bytes_ = 0;
+  std::atomic<uint64_t> packets_{0};
+  std::atomic<uint64_t> target_bytes_{0};
+  LoopbackServer server_;
+};
+
+}  // namespace buffy_host
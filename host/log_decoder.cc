@@ -0,0 +1,178 @@
+#include "log_decoder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "buffy_layout.h"
+
+namespace buffy_host {
+
+namespace {
+
+// Appends a single printf conversion.
+template <typename T>
+void AppendFormatted(std::string* out, const std::string& spec, T value) {
+  int len = snprintf(nullptr, 0, spec.c_str(), value);
+  if (len <= 0) return;
+  size_t pos = out->size();
+  out->resize(pos + len + 1);
+  snprintf(&(*out)[pos], len + 1, spec.c_str(), value);
+  out->resize(pos + len);
+}
+
+// A parsed printf conversion specification.
+struct Conversion {
+  std::string flags;    // Flags, width and precision, with '*' for arguments.
+  int star_args = 0;    // Number of '*' widths/precisions.
+  char conversion = 0;  // Conversion character, 0 if the format is truncated.
+};
+
+// Parses the conversion starting after the '%' at fmt[*pos]. Leaves *pos at
+// the conversion character.
+Conversion ParseConversion(const std::string& fmt, size_t* pos) {
+  Conversion c;
+  size_t i = *pos;
+  while (i < fmt.size() && strchr("-+ #0", fmt[i])) c.flags += fmt[i++];
+  for (int field = 0; field < 2; field++) {
+    if (field == 1) {
+      if (i >= fmt.size() || fmt[i] != '.') break;
+      c.flags += fmt[i++];
+    }
+    if (i < fmt.size() && fmt[i] == '*') {
+      c.flags += fmt[i++];
+      c.star_args++;
+    }
+    while (i < fmt.size() && fmt[i] >= '0' && fmt[i] <= '9') {
+      c.flags += fmt[i++];
+    }
+  }
+  // Length modifiers don't matter, all arguments are 32 bits on the target.
+  while (i < fmt.size() && strchr("hlLjzt", fmt[i])) i++;
+  if (i < fmt.size()) c.conversion = fmt[i];
+  *pos = i;
+  return c;
+}
+
+}  // namespace
+
+bool LogDecoder::LoadElf(const std::string& path) {
+  if (!elf_.Load(path)) return false;
+  const ElfFile::Section* section = elf_.FindSection(kFormatSection);
+  formats_ = section ? section->data : "";
+  return true;
+}
+
+void LogDecoder::SetFormats(const std::string& section) {
+  elf_ = ElfFile();
+  formats_ = section;
+}
+
+void LogDecoder::Feed(const uint8_t* data, size_t len) {
+  pending_.insert(pending_.end(), data, data + len);
+  size_t pos = 0;
+  while (pending_.size() - pos >= sizeof(uint32_t)) {
+    uint32_t id = ReadLe32(&pending_[pos]);
+    const char* format = FindFormat(id & ((1u << kLogLevelShift) - 1));
+    if (!format) {
+      // Not the start of a record, try to resync on the next byte.
+      pos++;
+      skipped_bytes_++;
+      continue;
+    }
+    size_t nargs = CountArgs(format);
+    size_t record_len = sizeof(uint32_t) * (1 + nargs);
+    if (pending_.size() - pos < record_len) break;
+    std::vector<uint32_t> args(nargs);
+    for (size_t i = 0; i < nargs; i++) {
+      args[i] = ReadLe32(&pending_[pos + sizeof(uint32_t) * (1 + i)]);
+    }
+    pos += record_len;
+    if (callback_) {
+      callback_(id >> kLogLevelShift, Format(format, args.data(), nargs));
+    }
+  }
+  pending_.erase(pending_.begin(), pending_.begin() + pos);
+}
+
+std::string LogDecoder::Format(const std::string& format,
+                               const uint32_t* args, size_t nargs) const {
+  std::string out;
+  size_t arg = 0;
+  auto next_arg = [&]() -> uint32_t { return arg < nargs ? args[arg++] : 0; };
+  for (size_t i = 0; i < format.size(); i++) {
+    if (format[i] != '%') {
+      out += format[i];
+      continue;
+    }
+    i++;
+    if (i < format.size() && format[i] == '%') {
+      out += '%';
+      continue;
+    }
+    Conversion c = ParseConversion(format, &i);
+    if (!c.conversion) break;
+    // Substitute '*' widths and precisions with their arguments.
+    std::string spec = "%";
+    for (char f : c.flags) {
+      spec += f == '*' ? std::to_string(static_cast<int32_t>(next_arg()))
+                       : std::string(1, f);
+    }
+    uint32_t value = next_arg();
+    switch (c.conversion) {
+      case 'd':
+      case 'i':
+        AppendFormatted(&out, spec + "d", static_cast<int32_t>(value));
+        break;
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        AppendFormatted(&out, spec + c.conversion, value);
+        break;
+      case 'c':
+        AppendFormatted(&out, spec + "c", static_cast<int>(value & 0xff));
+        break;
+      case 'p':
+        AppendFormatted(&out, "0x%08x", value);
+        break;
+      case 's': {
+        std::string str;
+        if (elf_.ReadString(value, &str)) {
+          AppendFormatted(&out, spec + "s", str.c_str());
+        } else {
+          AppendFormatted(&out, "<0x%08x>", value);
+        }
+        break;
+      }
+      default:
+        // Unsupported conversion, keep it as is.
+        out += spec + c.conversion;
+        break;
+    }
+  }
+  return out;
+}
+
+size_t LogDecoder::CountArgs(const std::string& format) {
+  size_t nargs = 0;
+  for (size_t i = 0; i < format.size(); i++) {
+    if (format[i] != '%') continue;
+    i++;
+    if (i < format.size() && format[i] == '%') continue;
+    Conversion c = ParseConversion(format, &i);
+    if (!c.conversion) break;
+    nargs += 1 + c.star_args;
+  }
+  return nargs;
+}
+
+const char* LogDecoder::FindFormat(uint32_t id) const {
+  // IDs point at the start of a string in the format section.
+  if (id >= formats_.size() || (id > 0 && formats_[id - 1] != '\0') ||
+      formats_[id] == '\0') {
+    return nullptr;
+  }
+  return formats_.c_str() + id;
+}
+
+}  // namespace buffy_host
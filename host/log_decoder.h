@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "elf_file.h"
+
+namespace buffy_host {
+
+// Decodes the binary records written by BUFFY_LOG back into text.
+//
+// Each record is a 32-bit format string ID (offset into the "buffy_fmt"
+// section of the firmware ELF file, with the severity level in the top bits)
+// followed by one 32-bit word per argument, all little-endian. The number of
+// arguments is taken from the format string.
+class LogDecoder {
+ public:
+  // level is one of the BUFFY_LEVEL_* values.
+  using MessageCallback =
+      std::function<void(int level, const std::string& message)>;
+
+  // Name of the ELF section holding the format strings.
+  static constexpr const char* kFormatSection = "buffy_fmt";
+
+  // Loads the format strings from a firmware ELF file. %s arguments are
+  // resolved against the other sections of the same file.
+  bool LoadElf(const std::string& path);
+
+  // Uses the given contents of the format string section. %s arguments are
+  // printed as addresses.
+  void SetFormats(const std::string& section);
+
+  void SetMessageCallback(MessageCallback callback) {
+    callback_ = std::move(callback);
+  }
+
+  // Feeds bytes read out of the TX buffer. Calls the message callback for
+  // every complete record, partial records are kept until more data arrives.
+  void Feed(const uint8_t* data, size_t len);
+
+  // Renders a format string with the given 32-bit arguments. Missing
+  // arguments are printed as zeroes.
+  std::string Format(const std::string& format, const uint32_t* args,
+                     size_t nargs) const;
+
+  // Returns the number of 32-bit arguments a format string takes.
+  static size_t CountArgs(const std::string& format);
+
+  // Number of bytes skipped because they didn't start a valid record.
+  uint64_t skipped_bytes() const { return skipped_bytes_; }
+
+  const std::string& error() const { return elf_.error(); }
+
+ private:
+  // Returns the format string for an ID, or nullptr if the ID is not valid.
+  const char* FindFormat(uint32_t id) const;
+
+  ElfFile elf_;
+  std::string formats_;
+  MessageCallback callback_;
+  std::vector<uint8_t> pending_;
+  uint64_t skipped_bytes_ = 0;
+};
+
+}  // namespace buffy_host
@@ -0,0 +1,162 @@
+#include "openocd_tcl.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tcp.h"
+
+namespace buffy_host {
+
+namespace {
+
+// Terminates commands and replies on the TCL port.
+constexpr char kTerminator = '\x1a';
+
+std::string Hex(uint32_t value) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "0x%x", value);
+  return buf;
+}
+
+}  // namespace
+
+// Header words: magic, version/sizes/flags, tx_tail, tx_head, rx_tail,
+// rx_head, tx_overflow_counter, tx_buf, rx_buf. Returns the header words
+// followed by the new TX data as bytes.
+const char OpenOcdTcl::kPollProc[] = R"(proc buffy_poll {addr} {
+  set h [read_memory $addr 32 9]
+  set tail [lindex $h 2]
+  set size [expr {1 << (([lindex $h 1] >> 8) & 0xff)}]
+  set used [expr {([lindex $h 3] - $tail) & 0xffffffff}]
+  if {$used == 0 || $used > $size} { return $h }
+  set buf [lindex $h 7]
+  set offset [expr {$tail & ($size - 1)}]
+  set first [expr {$size - $offset}]
+  if {$first > $used} { set first $used }
+  set data [read_memory [expr {$buf + $offset}] 8 $first]
+  if {$used > $first} {
+    set data [concat $data [read_memory $buf 8 [expr {$used - $first}]]]
+  }
+  write_memory [expr {$addr + 8}] 32 [expr {($tail + $used) & 0xffffffff}]
+  return [concat $h $data]
+})";
+
+OpenOcdTcl::~OpenOcdTcl() {
+  Close();
+}
+
+bool OpenOcdTcl::Connect(const std::string& host, int port) {
+  Close();
+  std::string error;
+  fd_ = TcpConnect(host, port, &error);
+  if (fd_ < 0) return Fail(error);
+
+  // proc returns nothing, anything else is an error message. Reads and
+  // writes still work without buffy_poll, only DrainTx() doesn't.
+  std::string result;
+  if (!Command(kPollProc, &result)) return false;
+  has_poll_proc_ = result.empty();
+  return true;
+}
+
+void OpenOcdTcl::Close() {
+  if (fd_ >= 0) close(fd_);
+  fd_ = -1;
+  buffer_.clear();
+}
+
+bool OpenOcdTcl::Command(const std::string& script, std::string* result) {
+  if (fd_ < 0) return Fail("not connected");
+  round_trips_++;
+  std::string request = script + kTerminator;
+  for (size_t sent = 0; sent < request.size();) {
+    ssize_t n = send(fd_, request.data() + sent, request.size() - sent,
+                     MSG_NOSIGNAL);
+    if (n <= 0) {
+      Close();
+      return Fail("send failed");
+    }
+    sent += n;
+  }
+  size_t end;
+  while ((end = buffer_.find(kTerminator)) == std::string::npos) {
+    char buf[4096];
+    ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      Close();
+      return Fail("connection closed");
+    }
+    buffer_.append(buf, n);
+  }
+  result->assign(buffer_, 0, end);
+  buffer_.erase(0, end + 1);
+  return true;
+}
+
+bool OpenOcdTcl::ReadMemory(uint32_t addr, uint8_t* buf, size_t len) {
+  std::string result;
+  if (!Command("read_memory " + Hex(addr) + " 8 " + std::to_string(len),
+               &result)) {
+    return false;
+  }
+  std::vector<uint32_t> bytes;
+  if (!ParseNumbers(result, &bytes)) return false;
+  if (bytes.size() != len) return Fail("short read: " + result);
+  for (size_t i = 0; i < len; i++) buf[i] = bytes[i];
+  return true;
+}
+
+bool OpenOcdTcl::WriteMemory(uint32_t addr, const uint8_t* buf, size_t len) {
+  std::string script = "write_memory " + Hex(addr) + " 8 {";
+  for (size_t i = 0; i < len; i++) {
+    if (i > 0) script += ' ';
+    script += Hex(buf[i]);
+  }
+  script += '}';
+  std::string result;
+  if (!Command(script, &result)) return false;
+  // Errors are the only output.
+  if (!result.empty()) return Fail(result);
+  return true;
+}
+
+bool OpenOcdTcl::DrainTx(uint32_t addr, BuffyHeader* header,
+                         std::vector<uint8_t>* data) {
+  std::string result;
+  if (!Command("buffy_poll " + Hex(addr), &result)) return false;
+  std::vector<uint32_t> numbers;
+  if (!ParseNumbers(result, &numbers)) return false;
+  constexpr size_t kHeaderWords = kHeaderSize / 4;
+  if (numbers.size() < kHeaderWords) return Fail("bad reply: " + result);
+  uint8_t buf[kHeaderSize];
+  for (size_t i = 0; i < kHeaderWords; i++) {
+    for (int j = 0; j < 4; j++) buf[i * 4 + j] = numbers[i] >> (8 * j);
+  }
+  *header = BuffyHeader::Parse(buf);
+  data->assign(numbers.begin() + kHeaderWords, numbers.end());
+  return true;
+}
+
+bool OpenOcdTcl::ParseNumbers(const std::string& result,
+                              std::vector<uint32_t>* out) {
+  out->clear();
+  const char* p = result.c_str();
+  while (true) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+    if (*p == '\0') return true;
+    char* end;
+    unsigned long value = strtoul(p, &end, 0);
+    if (end == p) return Fail("bad reply: " + result);
+    out->push_back(value);
+    p = end;
+  }
+}
+
+bool OpenOcdTcl::Fail(const std::string& error) {
+  error_ = error;
+  return false;
+}
+
+}  // namespace buffy_host
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "target_memory.h"
+
+namespace buffy_host {
+
+// Target memory access through OpenOCD's TCL server (tcl_port, 6666 by
+// default). Commands are Tcl scripts terminated by 0x1a, and so are the
+// replies. Needs OpenOCD 0.12 or newer for read_memory/write_memory.
+//
+// Connect() installs a buffy_poll procedure in OpenOCD's interpreter, which
+// drains the TX buffer server-side (see TargetMemory::DrainTx()): it reads the
+// header, computes the segments of new data, reads both of them and writes
+// back the tail, so a poll is a single round trip instead of four. If the
+// server won't take the procedure, polls fall back to separate requests.
+class OpenOcdTcl : public TargetMemory {
+ public:
+  OpenOcdTcl() = default;
+  ~OpenOcdTcl() override;
+  OpenOcdTcl(const OpenOcdTcl&) = delete;
+  OpenOcdTcl& operator=(const OpenOcdTcl&) = delete;
+
+  // Connects to the TCL server. Returns false on errors, see error().
+  bool Connect(const std::string& host, int port = 6666);
+  void Close();
+
+  // Runs a Tcl script and waits for its result.
+  bool Command(const std::string& script, std::string* result);
+
+  bool ReadMemory(uint32_t addr, uint8_t* buf, size_t len) override;
+  bool WriteMemory(uint32_t addr, const uint8_t* buf, size_t len) override;
+
+  bool SupportsDrainTx() const override {
+    return fd_ >= 0 && has_poll_proc_ && drain_tx_;
+  }
+  bool DrainTx(uint32_t addr, BuffyHeader* header,
+               std::vector<uint8_t>* data) override;
+
+  // Whether Reader may use DrainTx(), on by default. Turning it off makes
+  // polls use separate reads and writes, to compare the two.
+  void set_drain_tx(bool drain_tx) { drain_tx_ = drain_tx; }
+
+  // Commands sent so far, each of which is one round trip.
+  uint64_t round_trips() const { return round_trips_; }
+  const std::string& error() const { return error_; }
+
+  // Source of the buffy_poll procedure.
+  static const char kPollProc[];
+
+ private:
+  // Parses a result of whitespace separated numbers.
+  bool ParseNumbers(const std::string& result, std::vector<uint32_t>* out);
+  // Records the error and returns false.
+  bool Fail(const std::string& error);
+
+  int fd_ = -1;
+  std::string buffer_;  // Received data past the last reply.
+  bool has_poll_proc_ = false;  // Whether installing buffy_poll worked.
+  bool drain_tx_ = true;
+  uint64_t round_trips_ = 0;
+  std::string error_;
+};
+
+}  // namespace buffy_host
@@ -0,0 +1,80 @@
+#include "poll_scheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace buffy_host {
+
+PollScheduler::PollScheduler(uint32_t buffer_size, const Options& options)
+    : buffer_size_(buffer_size), options_(options) {
+  stats_.interval = options_.min_interval;
+}
+
+PollScheduler::Duration PollScheduler::Update(Clock::time_point now,
+                                              uint32_t bytes,
+                                              uint32_t overflow_counter) {
+  stats_.polls++;
+  stats_.bytes += bytes;
+  if (!started_) {
+    // Nothing to measure rates against yet, start from the fastest rate.
+    started_ = true;
+    start_ = last_ = now;
+    last_overflow_counter_ = overflow_counter;
+    return stats_.interval = options_.min_interval;
+  }
+
+  double elapsed = std::chrono::duration<double>(now - last_).count();
+  last_ = now;
+  if (elapsed > 0) {
+    double sample = bytes / elapsed;
+    stats_.fill_rate += options_.smoothing * (sample - stats_.fill_rate);
+  }
+  double total = std::chrono::duration<double>(now - start_).count();
+  if (total > 0) stats_.throughput = stats_.bytes / total;
+
+  uint32_t overflows = overflow_counter - last_overflow_counter_;
+  last_overflow_counter_ = overflow_counter;
+  stats_.overflows += overflows;
+
+  Duration interval;
+  if (overflows > 0) {
+    // Already too slow, poll as fast as possible until the estimate catches
+    // up.
+    interval = options_.min_interval;
+  } else if (bytes == 0) {
+    interval = Duration(static_cast<int64_t>(stats_.interval.count() *
+                                             options_.backoff));
+  } else {
+    double target_bytes = options_.target_occupancy * buffer_size_;
+    double rate = std::max(stats_.fill_rate, 1.0);
+    interval = Duration(static_cast<int64_t>(target_bytes / rate * 1e6));
+    // Don't wait longer than it took to collect this much data, so a burst
+    // tightens the interval right away.
+    double occupancy = static_cast<double>(bytes) / buffer_size_;
+    if (occupancy > options_.target_occupancy) {
+      interval = std::min(
+          interval,
+          Duration(static_cast<int64_t>(elapsed * 1e6 *
+                                        options_.target_occupancy /
+                                        occupancy)));
+    }
+  }
+  stats_.interval =
+      std::clamp(interval, options_.min_interval, options_.max_interval);
+  return stats_.interval;
+}
+
+bool RunPollLoop(Reader* reader, PollScheduler* scheduler,
+                 const std::function<bool()>& should_stop) {
+  while (!should_stop()) {
+    int bytes = reader->Poll();
+    if (bytes < 0) return false;
+    PollScheduler::Duration interval =
+        scheduler->Update(PollScheduler::Clock::now(), bytes,
+                          reader->header().tx_overflow_counter);
+    std::this_thread::sleep_for(interval);
+  }
+  return true;
+}
+
+}  // namespace buffy_host
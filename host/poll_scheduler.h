@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+
+#include "reader.h"
+
+namespace buffy_host {
+
+// Picks the interval between polls of the TX buffer.
+//
+// The fill rate is estimated from how far the head moved between polls. When
+// the target is idle the interval backs off exponentially, and as data comes
+// in it is tightened so that the next poll happens when the buffer is about
+// target_occupancy full, well before it overflows.
+class PollScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Duration = std::chrono::microseconds;
+
+  struct Options {
+    Duration min_interval = Duration(100);
+    Duration max_interval = Duration(100000);
+    // Fraction of the buffer that should be used when the next poll happens.
+    double target_occupancy = 0.5;
+    // Interval multiplier for polls that found no data.
+    double backoff = 2.0;
+    // Weight of the newest sample in the fill rate estimate.
+    double smoothing = 0.25;
+  };
+
+  struct Stats {
+    uint64_t polls = 0;
+    uint64_t bytes = 0;
+    // Overflows seen on the target since the first poll.
+    uint32_t overflows = 0;
+    // Estimated fill rate, bytes per second.
+    double fill_rate = 0;
+    // Bytes per second read since the first poll.
+    double throughput = 0;
+    // Interval chosen after the last poll.
+    Duration interval = Duration(0);
+  };
+
+  // buffer_size is the TX buffer size in bytes.
+  explicit PollScheduler(uint32_t buffer_size)
+      : PollScheduler(buffer_size, Options()) {}
+  PollScheduler(uint32_t buffer_size, const Options& options);
+
+  // Records a poll at 'now' that read 'bytes' and saw the given value of the
+  // target's tx_overflow_counter. Returns the interval until the next poll.
+  Duration Update(Clock::time_point now, uint32_t bytes,
+                  uint32_t overflow_counter);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  uint32_t buffer_size_;
+  Options options_;
+  Stats stats_;
+  bool started_ = false;
+  Clock::time_point start_;
+  Clock::time_point last_;
+  uint32_t last_overflow_counter_ = 0;
+};
+
+// Polls the reader until should_stop() returns true or a poll fails, sleeping
+// for the intervals picked by the scheduler in between. Returns false if
+// a poll failed.
+bool RunPollLoop(Reader* reader, PollScheduler* scheduler,
+                 const std::function<bool()>& should_stop);
+
+}  // namespace buffy_host
@@ -0,0 +1,306 @@
+#include "reader.h"
+
+#include <algorithm>
+
+namespace buffy_host {
+
+namespace {
+
+// Calls f(data, len) for each complete record in a flight recorder buffer.
+// Returns the number of records.
+template <typename F>
+size_t ForEachRecord(const uint8_t* data, size_t len, F f) {
+  size_t pos = 0;
+  size_t records = 0;
+  while (len - pos >= kRecordHeaderSize) {
+    size_t record_len = data[pos] | data[pos + 1] << 8;
+    pos += kRecordHeaderSize;
+    if (record_len > len - pos) break;
+    f(data + pos, record_len);
+    pos += record_len;
+    records++;
+  }
+  return records;
+}
+
+}  // namespace
+
+bool Reader::Attach() {
+  if (!ReadHeader()) return false;
+  if (header_.magic != kBuffyMagic) {
+    return Fail("no buffy magic at the given address");
+  }
+  if (header_.version < 1 || header_.version > 3) {
+    return Fail("unsupported buffy version " +
+                std::to_string(header_.version));
+  }
+  if (header_.tx_len_pow2 >= 32 || header_.rx_len_pow2 >= 32) {
+    return Fail("bad buffer sizes");
+  }
+  position_ = header_.tx_tail;
+  if (header_.flags & kFlagOverwrite) {
+    // Now that the flags are known, read tx_records too. Records still in
+    // the buffer will be read, the ones before them are none of our business.
+    if (!ReadHeader()) return false;
+    position_ = header_.tx_tail;
+    uint32_t len = header_.tx_head - position_;
+    if (len > header_.tx_size()) return Fail("TX head/tail out of bounds");
+    data_.resize(len);
+    if (!ReadRing(header_.tx_buf, header_.tx_len_pow2, position_, len,
+                  data_.data())) {
+      return false;
+    }
+    tx_records_ = header_.tx_records;
+    records_written_ =
+        ForEachRecord(data_.data(), len, [](const uint8_t*, size_t) {});
+  }
+  return true;
+}
+
+int Reader::Poll() {
+  if (header_.flags & kFlagOverwrite) return PollOverwrite();
+  if (header_.version >= 2 && memory_->SupportsDrainTx()) return PollDrain();
+  if (!ReadHeader()) return -1;
+  uint32_t tail = header_.tx_tail;
+  uint32_t used = Used(tail, header_.tx_head, header_.tx_len_pow2);
+  if (used > header_.tx_size()) {
+    Fail("TX head/tail out of bounds");
+    return -1;
+  }
+  if (used == 0) return 0;
+
+  data_.resize(used);
+  if (!ReadRing(header_.tx_buf, header_.tx_len_pow2, tail, used,
+                data_.data())) {
+    return -1;
+  }
+  // Hand the space back to the target as soon as possible.
+  uint32_t new_tail = tail + used;
+  if (header_.version == 1) new_tail &= header_.tx_size() - 1;
+  if (!memory_->Write32(addr_ + kTxTailOffset, new_tail)) {
+    Fail("failed to write TX tail");
+    return -1;
+  }
+  header_.tx_tail = new_tail;
+  bytes_read_ += used;
+  if (callback_) callback_(data_.data(), used);
+  return used;
+}
+
+int Reader::PollDrain() {
+  if (!memory_->DrainTx(addr_, &header_, &data_)) {
+    Fail("failed to drain TX buffer");
+    return -1;
+  }
+  uint32_t used = header_.tx_head - header_.tx_tail;
+  if (used > header_.tx_size()) {
+    Fail("TX head/tail out of bounds");
+    return -1;
+  }
+  if (data_.size() != used) {
+    Fail("short TX buffer read");
+    return -1;
+  }
+  header_.tx_tail += used;
+  if (used == 0) return 0;
+  bytes_read_ += used;
+  if (callback_) callback_(data_.data(), used);
+  return used;
+}
+
+int Reader::PollOverwrite() {
+  if (!ReadHeader()) return -1;
+  uint32_t size = header_.tx_size();
+  uint32_t head = header_.tx_head;
+  uint32_t start = position_;
+  // The target moves the tail over records it has overwritten.
+  if (static_cast<int32_t>(header_.tx_tail - start) > 0) {
+    lost_bytes_ += header_.tx_tail - start;
+    start = header_.tx_tail;
+  } else if (head - start > size) {
+    // Our position isn't in the buffer, e.g. the target reset its counters.
+    // Start over from the tail on the next poll.
+    position_ = header_.tx_tail;
+    Fail("TX read position out of bounds");
+    return -1;
+  }
+  uint32_t len = head - start;
+  if (len > size) {
+    Fail("TX head/tail out of bounds");
+    return -1;
+  }
+  if (len == 0) return 0;
+
+  data_.resize(len);
+  if (!ReadRing(header_.tx_buf, header_.tx_len_pow2, start, len,
+                data_.data())) {
+    return -1;
+  }
+  // Anything the target dropped while we were reading might be overwritten.
+  uint32_t tail;
+  if (!memory_->Read32(addr_ + kTxTailOffset, &tail)) {
+    Fail("failed to read TX tail");
+    return -1;
+  }
+  uint32_t skip = 0;
+  if (static_cast<int32_t>(tail - start) > 0) {
+    skip = std::min(tail - start, len);
+    lost_bytes_ += skip;
+  }
+  position_ = head;
+  bytes_read_ += len - skip;
+  records_read_ += DeliverRecords(data_.data() + skip, len - skip);
+  // Whatever tx_records counted that wasn't read got overwritten.
+  records_written_ += header_.tx_records - tx_records_;
+  tx_records_ = header_.tx_records;
+  lost_records_ = records_written_ > records_read_
+                      ? records_written_ - records_read_
+                      : 0;
+  return len - skip;
+}
+
+size_t Reader::DeliverRecords(const uint8_t* data, size_t len) {
+  return ForEachRecord(data, len, [this](const uint8_t* record, size_t n) {
+    if (callback_) callback_(record, n);
+  });
+}
+
+bool Reader::SetLevel(uint32_t level) {
+  if (!ReadHeader()) return false;
+  if (header_.version < 3) return Fail("no tx_level before version 3");
+  if (!memory_->Write32(addr_ + kTxLevelOffset, level)) {
+    return Fail("failed to write TX level");
+  }
+  return true;
+}
+
+int Reader::SendCommand(uint8_t id, const uint8_t* data, size_t len) {
+  if (kCommandHeaderSize + len > header_.rx_size() || len > 0xffff) {
+    Fail("command doesn't fit in the RX buffer");
+    return -1;
+  }
+  std::vector<uint8_t> frame = {id, 0, static_cast<uint8_t>(len),
+                                static_cast<uint8_t>(len >> 8)};
+  frame.insert(frame.end(), data, data + len);
+  int n = Write(frame.data(), frame.size(), frame.size());
+  return n < 0 ? -1 : n > 0;
+}
+
+int Reader::Write(const uint8_t* data, size_t len, size_t min_len) {
+  if (!ReadHeader()) return -1;
+  uint32_t size = header_.rx_size();
+  uint32_t used = Used(header_.rx_tail, header_.rx_head, header_.rx_len_pow2);
+  if (used > size) {
+    Fail("RX head/tail out of bounds");
+    return -1;
+  }
+  // Version 1 leaves one byte unused.
+  uint32_t free = size - used - (header_.version == 1 ? 1 : 0);
+  uint32_t n = std::min<size_t>(free, len);
+  if (n == 0 || n < min_len) return 0;
+
+  uint32_t head = header_.rx_head;
+  uint32_t offset = head & (size - 1);
+  uint32_t first_len = std::min(n, size - offset);
+  uint32_t second_len = n - first_len;
+  if (!memory_->WriteMemory(header_.rx_buf + offset, data, first_len) ||
+      (second_len > 0 &&
+       !memory_->WriteMemory(header_.rx_buf, data + first_len, second_len))) {
+    Fail("failed to write RX buffer");
+    return -1;
+  }
+  head += n;
+  if (header_.version == 1) head &= size - 1;
+  if (!memory_->Write32(addr_ + kRxHeadOffset, head)) {
+    Fail("failed to write RX head");
+    return -1;
+  }
+  header_.rx_head = head;
+  return n;
+}
+
+bool Reader::ReadHeader() {
+  uint8_t buf[kFlightRecorderHeaderSize];
+  size_t len = header_.flags & kFlagOverwrite ? kFlightRecorderHeaderSize
+                                              : kHeaderSize;
+  if (!memory_->ReadMemory(addr_, buf, len)) {
+    return Fail("failed to read buffy header");
+  }
+  header_ = BuffyHeader::Parse(buf, len);
+  return true;
+}
+
+bool Reader::ReadRing(uint32_t buf_addr, uint8_t len_pow2, uint32_t pos,
+                      uint32_t len, uint8_t* out) {
+  uint32_t size = 1u << len_pow2;
+  uint32_t offset = pos & (size - 1);
+  uint32_t first_len = std::min(len, size - offset);
+  if (!memory_->ReadMemory(buf_addr + offset, out, first_len) ||
+      (len > first_len &&
+       !memory_->ReadMemory(buf_addr, out + first_len, len - first_len))) {
+    return Fail("failed to read TX buffer");
+  }
+  return true;
+}
+
+uint32_t Reader::Used(uint32_t tail, uint32_t head, uint8_t len_pow2) const {
+  if (header_.version == 1) return (head - tail) & ((1u << len_pow2) - 1);
+  return head - tail;
+}
+
+bool Reader::Fail(const std::string& error) {
+  error_ = error;
+  return false;
+}
+
+bool ReadChannels(TargetMemory* memory, uint32_t root_addr,
+                  std::vector<Channel>* channels) {
+  // Read the header and a few channels in one go, most targets won't need
+  // more. That might run past the end of memory for small tables, so fall
+  // back to reading just the header.
+  size_t read_len = kRootHeaderSize + 8 * kChannelSize;
+  std::vector<uint8_t> buf(read_len);
+  if (!memory->ReadMemory(root_addr, buf.data(), read_len)) {
+    read_len = kRootHeaderSize;
+    if (!memory->ReadMemory(root_addr, buf.data(), read_len)) return false;
+  }
+  if (ReadLe32(buf.data()) != kBuffyRootMagic) return false;
+  size_t count = buf[5];
+  size_t total = kRootHeaderSize + count * kChannelSize;
+  if (total > read_len) {
+    buf.resize(total);
+    if (!memory->ReadMemory(root_addr + read_len, buf.data() + read_len,
+                            total - read_len)) {
+      return false;
+    }
+  }
+  channels->clear();
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t* entry = buf.data() + kRootHeaderSize + i * kChannelSize;
+    Channel channel;
+    const char* name = reinterpret_cast<const char*>(entry);
+    channel.name.assign(name, std::find(name, name + kChannelNameLen, '\0'));
+    channel.addr = ReadLe32(entry + kChannelNameLen);
+    channels->push_back(channel);
+  }
+  return true;
+}
+
+bool FindMagic(TargetMemory* memory, uint32_t start, uint32_t len,
+               uint32_t magic, uint32_t* addr, size_t chunk_size) {
+  std::vector<uint8_t> buf(chunk_size & ~3u);
+  start &= ~3u;
+  for (uint32_t pos = 0; pos + 4 <= len; pos += buf.size()) {
+    size_t n = std::min<size_t>(buf.size(), (len - pos) & ~3u);
+    if (!memory->ReadMemory(start + pos, buf.data(), n)) return false;
+    for (size_t i = 0; i < n; i += 4) {
+      if (ReadLe32(&buf[i]) == magic) {
+        *addr = start + pos + i;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace buffy_host
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "buffy_layout.h"
+#include "target_memory.h"
+
+namespace buffy_host {
+
+// Reads the TX buffer of a struct buffy on the target, and writes to its RX
+// buffer.
+//
+// Every poll reads the header once, then each of the (up to two) segments of
+// new data with a single bulk read, and finally writes back the TX tail. With
+// a TargetMemory that supports DrainTx(), all of that is a single request.
+// Handles both version 1 (wrapped indexes) and version 2 (free-running
+// counters) structures, and flight recorder mode.
+class Reader {
+ public:
+  // Called with new data from the TX buffer. In flight recorder mode, it is
+  // called once per record with the record's data.
+  using DataCallback = std::function<void(const uint8_t* data, size_t len)>;
+
+  // The reader doesn't own the memory, it must outlive the reader.
+  Reader(TargetMemory* memory, uint32_t addr) : memory_(memory), addr_(addr) {}
+
+  // Reads the structure and checks that it looks like buffy. Must be called
+  // before Poll() and Write(). Returns false on errors, see error().
+  bool Attach();
+
+  void SetDataCallback(DataCallback callback) {
+    callback_ = std::move(callback);
+  }
+
+  // Reads any new data out of the TX buffer and hands it to the callback.
+  //
+  // Returns the number of bytes read (including record headers), or -1 on
+  // errors.
+  int Poll();
+
+  // Queues data to the RX buffer.
+  //
+  // Returns the number of bytes queued, which might be smaller than len if
+  // the buffer is full, or -1 on errors.
+  int Write(const uint8_t* data, size_t len) { return Write(data, len, 1); }
+
+  // Queues a command frame for buffy_rx_poll() on the target, all or
+  // nothing.
+  //
+  // Returns 1 if the frame was queued, 0 if there isn't enough space in the
+  // RX buffer right now, or -1 on errors, including frames that could never
+  // fit.
+  int SendCommand(uint8_t id, const uint8_t* data, size_t len);
+
+  // Sets the channel's tx_level: the target skips records with a lower
+  // severity (BUFFY_LEVEL_*). Returns false on errors.
+  bool SetLevel(uint32_t level);
+
+  // Header as of the last Attach(), Poll() or Write().
+  const BuffyHeader& header() const { return header_; }
+  uint32_t addr() const { return addr_; }
+
+  uint64_t bytes_read() const { return bytes_read_; }
+  // Bytes that were overwritten before they could be read (flight recorder
+  // mode).
+  uint64_t lost_bytes() const { return lost_bytes_; }
+  // Records that were overwritten before they could be read (flight recorder
+  // mode), from the target's tx_records. A record that is being written
+  // during a poll can be counted until the next poll reads it.
+  uint64_t lost_records() const { return lost_records_; }
+
+  const std::string& error() const { return error_; }
+
+ private:
+  bool ReadHeader();
+  // Queues up to len bytes, or nothing if there's space for fewer than
+  // min_len.
+  int Write(const uint8_t* data, size_t len, size_t min_len);
+  // Reads len bytes starting at ring position pos into out, with one bulk
+  // read per contiguous segment.
+  bool ReadRing(uint32_t buf_addr, uint8_t len_pow2, uint32_t pos, uint32_t len,
+                uint8_t* out);
+  // Number of bytes between tail and head.
+  uint32_t Used(uint32_t tail, uint32_t head, uint8_t len_pow2) const;
+  int PollOverwrite();
+  int PollDrain();
+  // Hands each record to the callback. Returns the number of records.
+  size_t DeliverRecords(const uint8_t* data, size_t len);
+  // Records the error and returns false.
+  bool Fail(const std::string& error);
+
+  TargetMemory* memory_;
+  uint32_t addr_;
+  BuffyHeader header_ = {};
+  DataCallback callback_;
+  std::vector<uint8_t> data_;
+  // Read position in flight recorder mode, where the host doesn't write the
+  // tail.
+  uint32_t position_ = 0;
+  uint64_t bytes_read_ = 0;
+  uint64_t lost_bytes_ = 0;
+  // Flight recorder record counts: tx_records as of the last poll, records
+  // written since Attach() (including the ones in the buffer then), and the
+  // ones read.
+  uint32_t tx_records_ = 0;
+  uint64_t records_written_ = 0;
+  uint64_t records_read_ = 0;
+  uint64_t lost_records_ = 0;
+  std::string error_;
+};
+
+// A channel listed in a root descriptor.
+struct Channel {
+  std::string name;
+  uint32_t addr;  // Address of the channel's struct buffy.
+};
+
+// Reads the channel table of the root descriptor at root_addr. Returns false
+// if it isn't a valid root descriptor.
+bool ReadChannels(TargetMemory* memory, uint32_t root_addr,
+                  std::vector<Channel>* channels);
+
+// Looks for a magic word at 4-byte aligned addresses in [start, start + len),
+// reading chunk_size bytes at a time. Returns false if it wasn't found.
+bool FindMagic(TargetMemory* memory, uint32_t start, uint32_t len,
+               uint32_t magic, uint32_t* addr, size_t chunk_size = 1024);
+
+}  // namespace buffy_host
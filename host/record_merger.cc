@@ -0,0 +1,52 @@
+#include "record_merger.h"
+
+#include <algorithm>
+
+namespace buffy_host {
+
+RecordMerger::RecordMerger(size_t streams)
+    : decoders_(streams), seen_(streams, false), newest_(streams, 0) {
+  for (size_t i = 0; i < streams; i++) {
+    decoders_[i].SetWrapReference(&wrap_reference_);
+    decoders_[i].SetRecordCallback(
+        [this, i](const TimestampDecoder::Record& record) { Add(i, record); });
+  }
+}
+
+void RecordMerger::Feed(size_t stream, const uint8_t* data, size_t len,
+                        double host_time) {
+  decoders_[stream].Feed(data, len, host_time);
+  if (std::find(seen_.begin(), seen_.end(), false) != seen_.end()) return;
+  Release(*std::min_element(newest_.begin(), newest_.end()));
+}
+
+void RecordMerger::Flush() {
+  Release(UINT64_MAX);
+}
+
+void RecordMerger::Add(size_t stream, const TimestampDecoder::Record& record) {
+  if (!record.time_valid) {
+    if (callback_) {
+      callback_({stream, false, record.ticks, record.host_time, record.data,
+                 record.len});
+    }
+    return;
+  }
+  seen_[stream] = true;
+  newest_[stream] = record.ticks;
+  held_.push({stream, record.ticks, record.host_time, sequence_++,
+              std::vector<uint8_t>(record.data, record.data + record.len)});
+}
+
+void RecordMerger::Release(uint64_t ticks) {
+  while (!held_.empty() && held_.top().ticks <= ticks) {
+    const Held& h = held_.top();
+    if (callback_) {
+      callback_({h.stream, true, h.ticks, h.host_time, h.data.data(),
+                 h.data.size()});
+    }
+    held_.pop();
+  }
+}
+
+}  // namespace buffy_host
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "timestamp_decoder.h"
+
+namespace buffy_host {
+
+// Merges the timestamped records (buffy_tx_timestamped()) of several
+// channels, e.g. the per-core rings of INSTANTIATE_BUFFY_PERCPU, into one
+// stream ordered by target time. The order comes from the timestamps alone,
+// the target doesn't synchronize the writers, so they have to share a tick
+// source.
+//
+// Records of each stream arrive in order, but another stream might still
+// have older ones on the way: a record is held back until every stream has
+// delivered one at least as new. Flush() releases the rest, e.g. once the
+// target has gone idle. Records without a valid time (see
+// TimestampDecoder::Record) can't be ordered and are passed on right away.
+//
+// The target only sends the low 32 bits of time, and the decoders share the
+// count of wraps (TimestampDecoder::SetWrapReference()), so a stream that was
+// quiet over a wrap still gets ordered right. That takes polling every stream
+// often enough that none falls behind the others by half a wrap.
+class RecordMerger {
+ public:
+  struct Record {
+    size_t stream;
+    bool time_valid;
+    uint64_t ticks;
+    double host_time;
+    const uint8_t* data;
+    size_t len;
+  };
+  using RecordCallback = std::function<void(const Record& record)>;
+
+  explicit RecordMerger(size_t streams);
+  RecordMerger(const RecordMerger&) = delete;
+  RecordMerger& operator=(const RecordMerger&) = delete;
+
+  void SetRecordCallback(RecordCallback callback) {
+    callback_ = std::move(callback);
+  }
+
+  // Feeds bytes read out of the TX buffer of a stream at host time
+  // 'host_time', see TimestampDecoder::Feed().
+  void Feed(size_t stream, const uint8_t* data, size_t len,
+            double host_time);
+
+  // Tells the stream's decoder that records were lost.
+  void Reset(size_t stream) { decoders_[stream].Reset(); }
+
+  // Sets the TX buffer size of a stream's ring, see
+  // TimestampDecoder::set_buffer_size().
+  void set_buffer_size(size_t stream, size_t size) {
+    decoders_[stream].set_buffer_size(size);
+  }
+
+  // Passes on all held records.
+  void Flush();
+
+  size_t streams() const { return decoders_.size(); }
+  size_t held() const { return held_.size(); }
+  const TimestampDecoder& decoder(size_t stream) const {
+    return decoders_[stream];
+  }
+
+ private:
+  struct Held {
+    size_t stream;
+    uint64_t ticks;
+    double host_time;
+    uint64_t sequence;  // Arrival order, to keep ties stable.
+    std::vector<uint8_t> data;
+  };
+  struct Later {
+    bool operator()(const Held& a, const Held& b) const {
+      return a.ticks != b.ticks ? a.ticks > b.ticks : a.sequence > b.sequence;
+    }
+  };
+
+  void Add(size_t stream, const TimestampDecoder::Record& record);
+  // Passes on the held records up to and including 'ticks'.
+  void Release(uint64_t ticks);
+
+  RecordCallback callback_;
+  TimestampDecoder::WrapReference wrap_reference_;
+  std::vector<TimestampDecoder> decoders_;
+  // Time of the newest record of each stream, once it has one.
+  std::vector<bool> seen_;
+  std::vector<uint64_t> newest_;
+  std::priority_queue<Held, std::vector<Held>, Later> held_;
+  uint64_t sequence_ = 0;
+};
+
+}  // namespace buffy_host
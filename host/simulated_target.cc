@@ -0,0 +1,155 @@
+#include "simulated_target.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace buffy_host {
+
+namespace {
+
+// struct buffy fields as 32-bit words, in target layout order. The buffer
+// pointers are filled in by the caller.
+void StoreHeader(const struct buffy* b, uint32_t tx_buf, uint32_t rx_buf,
+                 uint32_t* words) {
+  words[0] = b->magic;
+  words[1] = b->version | b->tx_len_pow2 << 8 | b->rx_len_pow2 << 16 |
+             static_cast<uint32_t>(b->flags) << 24;
+  words[2] = __atomic_load_n(&b->tx_tail, __ATOMIC_ACQUIRE);
+  words[3] = __atomic_load_n(&b->tx_head, __ATOMIC_ACQUIRE);
+  words[4] = __atomic_load_n(&b->rx_tail, __ATOMIC_ACQUIRE);
+  words[5] = __atomic_load_n(&b->rx_head, __ATOMIC_ACQUIRE);
+  words[6] = __atomic_load_n(&b->tx_overflow_counter, __ATOMIC_ACQUIRE);
+  words[7] = tx_buf;
+  words[8] = rx_buf;
+  words[9] = __atomic_load_n(&b->tx_reserve, __ATOMIC_ACQUIRE);
+  words[10] = __atomic_load_n(&b->tx_writers, __ATOMIC_ACQUIRE);
+  words[11] = __atomic_load_n(&b->tx_records, __ATOMIC_ACQUIRE);
+  words[12] = __atomic_load_n(&b->tx_dropped_bytes, __ATOMIC_ACQUIRE);
+  words[13] = __atomic_load_n(&b->tx_dropped_records, __ATOMIC_ACQUIRE);
+  words[14] = b->tx_last_tick;
+  words[15] = b->tx_sync_countdown;
+  words[16] = __atomic_load_n(&b->tx_level, __ATOMIC_ACQUIRE);
+  // words[17] and [18] are the tick and wait hooks, host pointers here.
+  words[19] = b->tx_wait_limit;
+  words[20] = b->tx_stalled_tail;
+}
+
+// Host-writable struct buffy words.
+volatile uint32_t* WritableWord(struct buffy* b, size_t index) {
+  switch (index) {
+    case 2:
+      return &b->tx_tail;
+    case 3:
+      return &b->tx_head;
+    case 4:
+      return &b->rx_tail;
+    case 5:
+      return &b->rx_head;
+    case 6:
+      return &b->tx_overflow_counter;
+    case 16:
+      return &b->tx_level;
+    default:
+      return nullptr;
+  }
+}
+
+}  // namespace
+
+void SimulatedTarget::AddBuffy(uint32_t addr, struct buffy* buffy) {
+  regions_.push_back({addr, nullptr, buffy, kStructSize});
+  AddRegion(addr + kTxBufDistance, buffy->tx_buf, 1u << buffy->tx_len_pow2);
+  AddRegion(addr + kRxBufDistance, buffy->rx_buf, 1u << buffy->rx_len_pow2);
+}
+
+void SimulatedTarget::AddRegion(uint32_t addr, void* data, size_t len) {
+  regions_.push_back({addr, static_cast<uint8_t*>(data), nullptr, len});
+}
+
+bool SimulatedTarget::ReadMemory(uint32_t addr, uint8_t* buf, size_t len) {
+  read_requests_++;
+  if (!Read(addr, buf, len)) return false;
+  bytes_read_ += len;
+  return true;
+}
+
+bool SimulatedTarget::WriteMemory(uint32_t addr, const uint8_t* buf,
+                                  size_t len) {
+  write_requests_++;
+  return Write(addr, buf, len);
+}
+
+bool SimulatedTarget::DrainTx(uint32_t addr, BuffyHeader* header,
+                              std::vector<uint8_t>* data) {
+  // Same steps as a separate poll, just without the round trips.
+  read_requests_++;
+  uint8_t buf[kHeaderSize];
+  if (!Read(addr, buf, sizeof(buf))) return false;
+  *header = BuffyHeader::Parse(buf);
+  uint32_t size = header->tx_size();
+  uint32_t used = header->tx_head - header->tx_tail;
+  data->clear();
+  if (used == 0 || used > size) return true;
+  data->resize(used);
+  uint32_t offset = header->tx_tail & (size - 1);
+  uint32_t first_len = std::min(used, size - offset);
+  if (!Read(header->tx_buf + offset, data->data(), first_len) ||
+      !Read(header->tx_buf, data->data() + first_len, used - first_len)) {
+    return false;
+  }
+  bytes_read_ += sizeof(buf) + used;
+  uint32_t tail = header->tx_tail + used;
+  uint8_t tail_buf[4] = {static_cast<uint8_t>(tail),
+                         static_cast<uint8_t>(tail >> 8),
+                         static_cast<uint8_t>(tail >> 16),
+                         static_cast<uint8_t>(tail >> 24)};
+  return Write(addr + kTxTailOffset, tail_buf, sizeof(tail_buf));
+}
+
+bool SimulatedTarget::Read(uint32_t addr, uint8_t* buf, size_t len) {
+  const Region* region = FindRegion(addr, len);
+  if (!region) return false;
+  size_t offset = addr - region->addr;
+  if (region->buffy) {
+    uint32_t words[kStructSize / 4];
+    StoreHeader(region->buffy, region->addr + kTxBufDistance,
+                region->addr + kRxBufDistance, words);
+    memcpy(buf, reinterpret_cast<uint8_t*>(words) + offset, len);
+  } else {
+    memcpy(buf, region->data + offset, len);
+  }
+  return true;
+}
+
+bool SimulatedTarget::Write(uint32_t addr, const uint8_t* buf, size_t len) {
+  const Region* region = FindRegion(addr, len);
+  if (!region) return false;
+  size_t offset = addr - region->addr;
+  if (!region->buffy) {
+    memcpy(region->data + offset, buf, len);
+    return true;
+  }
+  // Only whole words of the fields the host owns can be written.
+  if (offset % 4 != 0 || len % 4 != 0) return false;
+  for (size_t i = 0; i < len / 4; i++) {
+    volatile uint32_t* word = WritableWord(region->buffy, offset / 4 + i);
+    if (!word) return false;
+    uint32_t value;
+    memcpy(&value, buf + i * 4, sizeof(value));
+    __atomic_store_n(word, value, __ATOMIC_RELEASE);
+  }
+  return true;
+}
+
+const SimulatedTarget::Region* SimulatedTarget::FindRegion(uint32_t addr,
+                                                           size_t len) const {
+  for (const Region& region : regions_) {
+    if (addr >= region.addr && addr - region.addr + len <= region.len) {
+      return &region;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace buffy_host
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "buffy.h"
+#include "target_memory.h"
+
+namespace buffy_host {
+
+// Target memory backed by host memory, for tests.
+//
+// Buffy structures run by the embedded library on the host are mapped into
+// a 32-bit address space with the same layout as on a real target, so the
+// host side can be exercised against the real target code, including from
+// another thread.
+class SimulatedTarget : public TargetMemory {
+ public:
+  // Default address of the buffy structure passed to the constructor.
+  static constexpr uint32_t kBuffyAddr = 0x20000000;
+
+  SimulatedTarget() = default;
+  explicit SimulatedTarget(struct buffy* buffy) { AddBuffy(kBuffyAddr, buffy); }
+
+  // Maps a buffy structure at addr, its TX buffer at addr + kTxBufDistance
+  // and its RX buffer at addr + kRxBufDistance.
+  static constexpr uint32_t kTxBufDistance = 0x100000;
+  static constexpr uint32_t kRxBufDistance = 0x200000;
+  void AddBuffy(uint32_t addr, struct buffy* buffy);
+
+  // Maps len bytes of host memory at addr.
+  void AddRegion(uint32_t addr, void* data, size_t len);
+
+  bool ReadMemory(uint32_t addr, uint8_t* buf, size_t len) override;
+  bool WriteMemory(uint32_t addr, const uint8_t* buf, size_t len) override;
+
+  // Batched TX drains are off by default, so that Reader uses the separate
+  // reads and writes. A drain counts as a single read request.
+  void set_drain_tx(bool enabled) { drain_tx_ = enabled; }
+  bool SupportsDrainTx() const override { return drain_tx_; }
+  bool DrainTx(uint32_t addr, BuffyHeader* header,
+               std::vector<uint8_t>* data) override;
+
+  uint64_t read_requests() const { return read_requests_; }
+  uint64_t write_requests() const { return write_requests_; }
+  uint64_t bytes_read() const { return bytes_read_; }
+
+ private:
+  // Size of the emulated struct buffy, including target-only state.
+  static constexpr size_t kStructSize = 84;
+
+  struct Region {
+    uint32_t addr;
+    uint8_t* data;        // Raw memory, or
+    struct buffy* buffy;  // an emulated buffy structure.
+    size_t len;
+  };
+
+  const Region* FindRegion(uint32_t addr, size_t len) const;
+  // ReadMemory() and WriteMemory() without the statistics.
+  bool Read(uint32_t addr, uint8_t* buf, size_t len);
+  bool Write(uint32_t addr, const uint8_t* buf, size_t len);
+
+  std::vector<Region> regions_;
+  bool drain_tx_ = false;
+  uint64_t read_requests_ = 0;
+  uint64_t write_requests_ = 0;
+  uint64_t bytes_read_ = 0;
+};
+
+}  // namespace buffy_host
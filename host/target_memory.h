@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "buffy_layout.h"
+
+namespace buffy_host {
+
+// Access to the memory of a running target, e.g. through a debug adapter.
+//
+// Every call is expected to be a single request to the target, so callers
+// should read as much as they need in one go.
+class TargetMemory {
+ public:
+  virtual ~TargetMemory() = default;
+
+  // Reads len bytes starting at addr. Returns false on errors.
+  virtual bool ReadMemory(uint32_t addr, uint8_t* buf, size_t len) = 0;
+
+  // Writes len bytes starting at addr. Returns false on errors.
+  virtual bool WriteMemory(uint32_t addr, const uint8_t* buf, size_t len) = 0;
+
+  // Optional batched TX drain, for transports that can run logic next to the
+  // target: reads the struct buffy header at addr and all the TX data between
+  // tail and head, then writes head back to the tail, in a single request.
+  // The returned header is the one before the tail was written. Only used on
+  // version 2+ structures that aren't in flight recorder mode.
+  virtual bool SupportsDrainTx() const { return false; }
+
+  // Returns false on errors.
+  virtual bool DrainTx(uint32_t addr, BuffyHeader* header,
+                       std::vector<uint8_t>* data) {
+    return false;
+  }
+
+  // Helpers for single little-endian 32-bit words.
+  bool Read32(uint32_t addr, uint32_t* value) {
+    uint8_t buf[4];
+    if (!ReadMemory(addr, buf, sizeof(buf))) return false;
+    *value = buf[0] | buf[1] << 8 | buf[2] << 16 |
+             static_cast<uint32_t>(buf[3]) << 24;
+    return true;
+  }
+
+  bool Write32(uint32_t addr, uint32_t value) {
+    uint8_t buf[4] = {static_cast<uint8_t>(value),
+                      static_cast<uint8_t>(value >> 8),
+                      static_cast<uint8_t>(value >> 16),
+                      static_cast<uint8_t>(value >> 24)};
+    return WriteMemory(addr, buf, sizeof(buf));
+  }
+};
+
+}  // namespace buffy_host
@@ -0,0 +1,188 @@
+#include "tcl_server.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace buffy_host {
+
+namespace {
+
+constexpr char kTerminator = '\x1a';
+
+// Splits a command into words. Braces group words, like in Tcl, and are
+// removed from the outermost level.
+std::vector<std::string> SplitWords(const std::string& command) {
+  std::vector<std::string> words;
+  size_t i = 0;
+  while (true) {
+    while (i < command.size() && isspace(command[i])) i++;
+    if (i >= command.size()) return words;
+    std::string word;
+    if (command[i] == '{') {
+      int depth = 1;
+      for (i++; i < command.size(); i++) {
+        if (command[i] == '{') depth++;
+        if (command[i] == '}' && --depth == 0) break;
+        word += command[i];
+      }
+      i++;
+    } else {
+      while (i < command.size() && !isspace(command[i])) word += command[i++];
+    }
+    words.push_back(word);
+  }
+}
+
+bool ParseNumber(const std::string& word, uint64_t* value) {
+  char* end;
+  *value = strtoull(word.c_str(), &end, 0);
+  return !word.empty() && *end == '\0';
+}
+
+std::string Hex(uint64_t value) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "0x%llx", static_cast<unsigned long long>(value));
+  return buf;
+}
+
+}  // namespace
+
+TclServer::TclServer(TargetMemory* memory, const Options& options)
+    : memory_(memory),
+      options_(options),
+      server_([this](int fd) { ServeClient(fd); }) {}
+
+TclServer::~TclServer() {
+  Stop();
+}
+
+void TclServer::ServeClient(int fd) {
+  // OpenOCD keeps procs across connections, but OpenOcdTcl defines
+  // buffy_poll on every connect, and this way tests can't pass by accident.
+  poll_defined_ = false;
+  std::string pending;
+  char buf[4096];
+  ssize_t n;
+  while (!server_.stopping() && (n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+    pending.append(buf, n);
+    size_t end;
+    while ((end = pending.find(kTerminator)) != std::string::npos) {
+      delay_bytes_ = 0;
+      std::string reply = Execute(pending.substr(0, end));
+      pending.erase(0, end + 1);
+      Delay(delay_bytes_);
+      reply += kTerminator;
+      if (send(fd, reply.data(), reply.size(), MSG_NOSIGNAL) < 0) return;
+    }
+  }
+}
+
+std::string TclServer::Execute(const std::string& command) {
+  commands_++;
+  std::vector<std::string> words = SplitWords(command);
+  if (words.empty()) return "";
+  const std::string& name = words[0];
+  uint64_t addr, width, count;
+  if (name == "read_memory" && words.size() == 4 &&
+      ParseNumber(words[1], &addr) && ParseNumber(words[2], &width) &&
+      ParseNumber(words[3], &count)) {
+    return ReadMemory(addr, width, count);
+  }
+  if (name == "write_memory" && words.size() == 4 &&
+      ParseNumber(words[1], &addr) && ParseNumber(words[2], &width)) {
+    return WriteMemory(addr, width, words[3]);
+  }
+  if (name == "proc" && words.size() == 4) {
+    if (words[1] == "buffy_poll") poll_defined_ = true;
+    return "";
+  }
+  if (name == "buffy_poll" && poll_defined_ && words.size() == 2 &&
+      ParseNumber(words[1], &addr)) {
+    return Poll(addr);
+  }
+  if (name == "read_memory" || name == "write_memory" ||
+      (name == "buffy_poll" && poll_defined_)) {
+    return "wrong # args or bad argument to " + name;
+  }
+  return "invalid command name \"" + name + "\"";
+}
+
+std::string TclServer::ReadMemory(uint32_t addr, int width, size_t count) {
+  if (width != 8 && width != 16 && width != 32 && width != 64) {
+    return "invalid width " + std::to_string(width);
+  }
+  size_t size = width / 8;
+  std::vector<uint8_t> buf(count * size);
+  if (!memory_->ReadMemory(addr, buf.data(), buf.size())) {
+    return "failed to read memory";
+  }
+  delay_bytes_ += buf.size();
+  target_bytes_ += buf.size();
+  std::string result;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t value = 0;
+    for (size_t j = 0; j < size; j++) {
+      value |= static_cast<uint64_t>(buf[i * size + j]) << (8 * j);
+    }
+    if (i > 0) result += ' ';
+    result += Hex(value);
+  }
+  return result;
+}
+
+std::string TclServer::WriteMemory(uint32_t addr, int width,
+                                   const std::string& list) {
+  if (width != 8 && width != 16 && width != 32 && width != 64) {
+    return "invalid width " + std::to_string(width);
+  }
+  size_t size = width / 8;
+  std::vector<uint8_t> buf;
+  for (const std::string& word : SplitWords(list)) {
+    uint64_t value;
+    if (!ParseNumber(word, &value)) return "bad value " + word;
+    for (size_t j = 0; j < size; j++) buf.push_back(value >> (8 * j));
+  }
+  if (!memory_->WriteMemory(addr, buf.data(), buf.size())) {
+    return "failed to write memory";
+  }
+  delay_bytes_ += buf.size();
+  target_bytes_ += buf.size();
+  return "";
+}
+
+std::string TclServer::Poll(uint32_t addr) {
+  std::string header = ReadMemory(addr, 32, kHeaderSize / 4);
+  std::vector<std::string> words = SplitWords(header);
+  std::vector<uint64_t> h(words.size());
+  for (size_t i = 0; i < words.size(); i++) {
+    if (!ParseNumber(words[i], &h[i])) return header;  // An error.
+  }
+  uint64_t tail = h[2];
+  uint64_t size = 1ull << ((h[1] >> 8) & 0xff);
+  uint64_t used = (h[3] - tail) & 0xffffffff;
+  if (used == 0 || used > size) return header;
+  uint64_t offset = tail & (size - 1);
+  uint64_t first = std::min(size - offset, used);
+  std::string result = header + ' ' + ReadMemory(h[7] + offset, 8, first);
+  if (used > first) result += ' ' + ReadMemory(h[7], 8, used - first);
+  std::string error =
+      WriteMemory(addr + kTxTailOffset, 32, Hex((tail + used) & 0xffffffff));
+  return error.empty() ? result : error;
+}
+
+void TclServer::Delay(size_t bytes) {
+  std::chrono::duration<double> delay = options_.latency;
+  if (options_.bandwidth > 0) {
+    delay += std::chrono::duration<double>(bytes / options_.bandwidth);
+  }
+  if (delay.count() > 0) std::this_thread::sleep_for(delay);
+}
+
+}  // namespace buffy_host
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "target_memory.h"
+#include "tcp.h"
+
+namespace buffy_host {
+
+// Stand-in for OpenOCD's TCL server, for benchmarks and tests without
+// hardware. Serves target memory (typically a SimulatedTarget with buffy.c
+// writing into it from another thread) to one client at a time, speaking
+// the 0x1a-terminated protocol of OpenOCD's tcl_port.
+//
+// Only understands what OpenOcdTcl sends: read_memory, write_memory, and
+// buffy_poll once a proc of that name has been defined, which runs natively
+// here with the same steps as OpenOcdTcl::kPollProc. Every command can be
+// slowed down to model the debug adapter.
+class TclServer {
+ public:
+  struct Options {
+    // Added to every command.
+    std::chrono::microseconds latency = std::chrono::microseconds(0);
+    // Bytes per second for the target memory a command reads or writes, 0
+    // for no limit.
+    double bandwidth = 0;
+  };
+
+  // The memory must outlive the server.
+  TclServer(TargetMemory* memory, const Options& options);
+  explicit TclServer(TargetMemory* memory) : TclServer(memory, Options()) {}
+  ~TclServer();
+  TclServer(const TclServer&) = delete;
+  TclServer& operator=(const TclServer&) = delete;
+
+  // Starts serving on a loopback port, 0 picks a free one. Returns false on
+  // errors.
+  bool Start(int port = 0) { return server_.Start(port); }
+  void Stop() { server_.Stop(); }
+  int port() const { return server_.port(); }
+
+  // Runs a single command and returns its result, or an error message like
+  // OpenOCD would.
+  std::string Execute(const std::string& command);
+
+  uint64_t commands() const { return commands_; }
+  uint64_t target_bytes() const { return target_bytes_; }
+
+ private:
+  void ServeClient(int fd);
+  std::string ReadMemory(uint32_t addr, int width, size_t count);
+  std::string WriteMemory(uint32_t addr, int width, const std::string& list);
+  std::string Poll(uint32_t addr);
+  // Sleeps for the modelled time of a command that moved 'bytes' bytes of
+  // target memory.
+  void Delay(size_t bytes);
+
+  TargetMemory* memory_;
+  Options options_;
+  bool poll_defined_ = false;
+  size_t delay_bytes_ = 0;
+  std::atomic<uint64_t> commands_{0};
+  std::atomic<uint64_t> target_bytes_{0};
+  LoopbackServer server_;
+};
+
+}  // namespace buffy_host
@@ -0,0 +1,98 @@
+#include "tcp.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace buffy_host {
+
+int TcpConnect(const std::string& host, int port, std::string* error) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addrs;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &addrs) != 0) {
+    *error = "can't resolve " + host;
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo* a = addrs; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0) continue;
+    if (connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  if (fd < 0) {
+    *error = "can't connect to " + host;
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+LoopbackServer::~LoopbackServer() {
+  Stop();
+}
+
+bool LoopbackServer::Start(int port) {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) return false;
+  int one = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  socklen_t len = sizeof(addr);
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), len) != 0 ||
+      getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len) != 0 ||
+      listen(listen_fd_, 1) != 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+  port_ = ntohs(addr.sin_port);
+  stop_ = false;
+  thread_ = std::thread([this]() { Serve(); });
+  return true;
+}
+
+void LoopbackServer::Stop() {
+  if (listen_fd_ < 0) return;
+  stop_ = true;
+  // Wake up accept() and recv().
+  shutdown(listen_fd_, SHUT_RDWR);
+  {
+    std::lock_guard<std::mutex> lock(client_mutex_);
+    if (client_fd_ >= 0) shutdown(client_fd_, SHUT_RDWR);
+  }
+  thread_.join();
+  close(listen_fd_);
+  listen_fd_ = -1;
+}
+
+void LoopbackServer::Serve() {
+  while (!stop_) {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) continue;
+    {
+      std::lock_guard<std::mutex> lock(client_mutex_);
+      client_fd_ = fd;
+    }
+    handler_(fd);
+    {
+      std::lock_guard<std::mutex> lock(client_mutex_);
+      client_fd_ = -1;
+    }
+    close(fd);
+  }
+}
+
+}  // namespace buffy_host
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace buffy_host {
+
+// Connects to host:port over TCP with Nagle off, since the transports send
+// small requests and wait for each reply. Returns the socket, or -1 with the
+// reason in *error.
+int TcpConnect(const std::string& host, int port, std::string* error);
+
+// Accepts connections on a loopback port from a thread of its own and hands
+// them to a handler one at a time. This is the socket side of the stand-in
+// servers (TclServer, GdbServer).
+class LoopbackServer {
+ public:
+  // Runs on the server thread for every connection. The socket is closed
+  // when it returns, it should return soon after stopping() turns true.
+  using Handler = std::function<void(int fd)>;
+
+  explicit LoopbackServer(Handler handler) : handler_(std::move(handler)) {}
+  ~LoopbackServer();
+  LoopbackServer(const LoopbackServer&) = delete;
+  LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+  // Starts listening, 0 picks a free port. Returns false on errors.
+  bool Start(int port);
+  // Wakes up the handler and waits for the server thread.
+  void Stop();
+  int port() const { return port_; }
+  bool stopping() const { return stop_; }
+
+ private:
+  void Serve();
+
+  Handler handler_;
+  int listen_fd_ = -1;
+  int port_ = 0;
+  std::thread thread_;
+  std::atomic<bool> stop_{false};
+  std::mutex client_mutex_;
+  int client_fd_ = -1;
+};
+
+}  // namespace buffy_host
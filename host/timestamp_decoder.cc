@@ -0,0 +1,136 @@
+#include "timestamp_decoder.h"
+
+namespace buffy_host {
+
+namespace {
+
+// Times have up to 33 bits and lengths up to 32, 5 varint bytes either way.
+constexpr int kMaxVarintBytes = 5;
+
+enum class VarintResult { kOk, kIncomplete, kTooLong };
+
+// Reads a LEB128 varint from data[*pos, len).
+VarintResult GetVarint(const uint8_t* data, size_t len, size_t* pos,
+                       uint64_t* value) {
+  *value = 0;
+  for (int i = 0; i < kMaxVarintBytes; i++) {
+    if (*pos == len) return VarintResult::kIncomplete;
+    uint8_t byte = data[(*pos)++];
+    *value |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+    if (!(byte & 0x80)) return VarintResult::kOk;
+  }
+  return VarintResult::kTooLong;
+}
+
+}  // namespace
+
+void ClockEstimator::AddSample(uint64_t ticks, double host_time) {
+  if (n_ == 0) {
+    first_ticks_ = ticks;
+    first_time_ = host_time;
+  }
+  double x = static_cast<double>(ticks - first_ticks_);
+  double y = host_time - first_time_;
+  n_++;
+  sum_x_ += x;
+  sum_y_ += y;
+  sum_xx_ += x * x;
+  sum_xy_ += x * y;
+}
+
+bool ClockEstimator::ready() const {
+  return n_ >= 2 && n_ * sum_xx_ - sum_x_ * sum_x_ > 0;
+}
+
+double ClockEstimator::ticks_per_second() const {
+  if (!ready()) return 0;
+  double seconds_per_tick =
+      (n_ * sum_xy_ - sum_x_ * sum_y_) / (n_ * sum_xx_ - sum_x_ * sum_x_);
+  return 1 / seconds_per_tick;
+}
+
+double ClockEstimator::ToHostTime(uint64_t ticks) const {
+  if (!ready()) return 0;
+  double slope =
+      (n_ * sum_xy_ - sum_x_ * sum_y_) / (n_ * sum_xx_ - sum_x_ * sum_x_);
+  double intercept = (sum_y_ - slope * sum_x_) / n_;
+  double x = static_cast<double>(static_cast<int64_t>(ticks - first_ticks_));
+  return first_time_ + intercept + slope * x;
+}
+
+void TimestampDecoder::Feed(const uint8_t* data, size_t len,
+                            double host_time) {
+  pending_.insert(pending_.end(), data, data + len);
+  size_t pos = 0;
+  bool got_record = false;
+  ParseResult result;
+  while ((result = ParseRecord(&pos)) == ParseResult::kRecord) {
+    got_record = true;
+  }
+  if (got_record && time_valid_) clock_.AddSample(ticks_, host_time);
+  pending_.erase(pending_.begin(), pending_.begin() + pos);
+  // A partial record can't be longer than the buffer either.
+  if (result == ParseResult::kCorrupt || pending_.size() > buffer_size_) {
+    errors_++;
+    Reset();
+  }
+}
+
+void TimestampDecoder::Reset() {
+  pending_.clear();
+  time_valid_ = false;
+}
+
+TimestampDecoder::ParseResult TimestampDecoder::ParseRecord(size_t* pos) {
+  size_t p = *pos;
+  uint64_t time, len;
+  VarintResult result = GetVarint(pending_.data(), pending_.size(), &p, &time);
+  if (result == VarintResult::kOk) {
+    result = GetVarint(pending_.data(), pending_.size(), &p, &len);
+  }
+  if (result == VarintResult::kIncomplete) return ParseResult::kIncomplete;
+  // The whole record, header included, has to fit in the TX buffer.
+  if (result == VarintResult::kTooLong || time >> 33 ||
+      p - *pos + len > buffer_size_) {
+    return ParseResult::kCorrupt;
+  }
+  if (len > pending_.size() - p) return ParseResult::kIncomplete;
+  if (time & 1) {
+    // Absolute time, only the low 32 bits. Keep the wraps counted so far,
+    // assuming less than a whole wrap went by since the last record.
+    uint32_t now = time >> 1;
+    ticks_ += static_cast<uint32_t>(now - static_cast<uint32_t>(ticks_));
+    time_valid_ = true;
+  } else {
+    ticks_ += time >> 1;
+  }
+  if (reference_ && time_valid_) {
+    if (reference_->valid) {
+      // Only the low 32 bits are certain, the record could have come after
+      // any number of wraps.
+      int64_t offset = static_cast<int32_t>(static_cast<uint32_t>(ticks_) -
+                                            static_cast<uint32_t>(
+                                                reference_->ticks));
+      if (offset < 0 && static_cast<uint64_t>(-offset) > reference_->ticks) {
+        offset += int64_t{1} << 32;
+      }
+      ticks_ = reference_->ticks + offset;
+    }
+    if (!reference_->valid || ticks_ > reference_->ticks) {
+      reference_->valid = true;
+      reference_->ticks = ticks_;
+    }
+  }
+  Record record;
+  record.time_valid = time_valid_;
+  record.ticks = ticks_;
+  record.host_time = clock_.ToHostTime(ticks_);
+  record.data = pending_.data() + p;
+  record.len = len;
+  records_++;
+  if (callback_) callback_(record);
+  *pos = p + len;
+  return ParseResult::kRecord;
+}
+
+}  // namespace buffy_host
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+namespace buffy_host {
+
+// Estimates the target clock against host time from (target ticks, host
+// time) pairs with a least squares fit. Host times are in seconds, from
+// whatever clock the caller uses (e.g. wall-clock time of each poll).
+class ClockEstimator {
+ public:
+  void AddSample(uint64_t ticks, double host_time);
+
+  // True once there are samples at two different tick values.
+  bool ready() const;
+
+  // Estimated target tick rate.
+  double ticks_per_second() const;
+
+  // Host time at which the target clock showed 'ticks'.
+  double ToHostTime(uint64_t ticks) const;
+
+  size_t samples() const { return n_; }
+
+ private:
+  // Sums over samples relative to the first one, to keep the precision.
+  uint64_t first_ticks_ = 0;
+  double first_time_ = 0;
+  size_t n_ = 0;
+  double sum_x_ = 0;
+  double sum_y_ = 0;
+  double sum_xx_ = 0;
+  double sum_xy_ = 0;
+};
+
+// Decodes the records written by buffy_tx_timestamped() and reconstructs
+// absolute target time, extended to 64 bits.
+class TimestampDecoder {
+ public:
+  struct Record {
+    // False if the absolute time is not known: after Reset(), until the next
+    // record that carries absolute time.
+    bool time_valid;
+    uint64_t ticks;
+    // Estimated host time of the record, valid once clock().ready().
+    double host_time;
+    const uint8_t* data;
+    size_t len;
+  };
+  using RecordCallback = std::function<void(const Record& record)>;
+
+  // Newest time seen by a group of decoders, see SetWrapReference().
+  struct WrapReference {
+    bool valid = false;
+    uint64_t ticks = 0;
+  };
+
+  void SetRecordCallback(RecordCallback callback) {
+    callback_ = std::move(callback);
+  }
+
+  // Shares the count of 32-bit wraps with other decoders whose targets use
+  // the same tick source: each time is placed within half a wrap of the
+  // newest time any of them has seen. On its own, a decoder only keeps count
+  // of the wraps between its own records, so a stream that was quiet over a
+  // wrap would land a whole wrap early. The reference must outlive the
+  // decoder.
+  void SetWrapReference(WrapReference* reference) { reference_ = reference; }
+
+  // Feeds bytes read out of the TX buffer at host time 'host_time'. Calls the
+  // record callback for every complete record, partial records are kept
+  // until more data arrives. The newest record of each read is used as a
+  // clock sample: it was written shortly before the read.
+  //
+  // Data that can't be a record (a varint that's too long, a record longer
+  // than the buffer) is dropped along with everything buffered, as after
+  // Reset().
+  void Feed(const uint8_t* data, size_t len, double host_time);
+
+  // Tells the decoder that records were lost (e.g. overwritten in flight
+  // recorder mode). Time is unknown until the next absolute timestamp.
+  void Reset();
+
+  // Size of the target's TX buffer, which no record can be longer than.
+  // Anything longer is taken as corrupt.
+  void set_buffer_size(size_t size) { buffer_size_ = size; }
+
+  const ClockEstimator& clock() const { return clock_; }
+  uint64_t records() const { return records_; }
+  // Number of times corrupt data was dropped, see Feed().
+  uint64_t errors() const { return errors_; }
+
+  static constexpr size_t kDefaultBufferSize = 65536;
+
+ private:
+  enum class ParseResult { kRecord, kIncomplete, kCorrupt };
+
+  // Parses one record from the front of pending_ starting at *pos.
+  ParseResult ParseRecord(size_t* pos);
+
+  RecordCallback callback_;
+  WrapReference* reference_ = nullptr;
+  ClockEstimator clock_;
+  std::vector<uint8_t> pending_;
+  bool time_valid_ = false;
+  uint64_t ticks_ = 0;
+  uint64_t records_ = 0;
+  uint64_t errors_ = 0;
+  size_t buffer_size_ = kDefaultBufferSize;
+};
+
+}  // namespace buffy_host
@@ -0,0 +1,170 @@
+// Host benchmarks for the target side API.
+//
+// Prints one CSV line per measurement to stdout:
+//
+//   op,buffer,msg,wrap,calls,bytes,dropped,ns_per_call,ns_per_byte
+//
+// op:      tx, tx_buffer_read, rx, or tx_concurrent (buffy_tx with a reader
+//          thread draining the buffer at the same time).
+// buffer:  TX/RX buffer size in bytes.
+// msg:     bytes passed per call.
+// wrap:    0 if each call starts at the beginning of the buffer, 1 if each
+//          call straddles the end of the buffer and has to copy two segments.
+// bytes:   bytes actually transferred; ns_per_byte is per transferred byte.
+// dropped: bytes buffy_tx didn't take because the buffer was full. For
+//          tx_concurrent this depends on how much CPU time the reader thread
+//          gets, so it is only comparable between runs on the same machine.
+//
+// Usage: buffy_bench [min_time_ms]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "buffy.h"
+
+INSTANTIATE_BUFFY_SIZED(small, 256, 256);
+INSTANTIATE_BUFFY_SIZED(medium, 4096, 4096);
+INSTANTIATE_BUFFY_SIZED(large, 65536, 65536);
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct buffy* const kBuffies[] = {&small, &medium, &large};
+const int kMessageSizes[] = {1, 4, 16, 64, 256, 1024, 4096};
+
+int64_t min_time_ns = 20 * 1000 * 1000;
+
+struct Result {
+  uint64_t calls = 0;
+  uint64_t bytes = 0;
+  uint64_t dropped = 0;
+  int64_t ns = 0;
+};
+
+void Print(const char* op, struct buffy* t, int msg, int wrap,
+           const Result& r) {
+  printf("%s,%d,%d,%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.3f,%.4f\n", op,
+         buffy_tx_get_buffer_size(t), msg, wrap, r.calls, r.bytes, r.dropped,
+         r.calls ? static_cast<double>(r.ns) / r.calls : 0.0,
+         r.bytes ? static_cast<double>(r.ns) / r.bytes : 0.0);
+  fflush(stdout);
+}
+
+// Calls |fn| in batches of growing size until at least min_time_ns has
+// passed. |fn| returns the number of bytes transferred by a single call.
+template <typename Fn>
+Result Measure(Fn fn) {
+  Result r;
+  for (uint64_t batch = 16; r.ns < min_time_ns; batch *= 2) {
+    Clock::time_point start = Clock::now();
+    for (uint64_t i = 0; i < batch; i++) r.bytes += fn();
+    r.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - start)
+                .count();
+    r.calls += batch;
+  }
+  return r;
+}
+
+// Where a call should start so that it doesn't / does wrap around the end
+// of the buffer.
+uint32_t StartPosition(struct buffy* t, int msg, int wrap) {
+  return wrap ? buffy_tx_get_buffer_size(t) - msg / 2 : 0;
+}
+
+void BenchTx(struct buffy* t, int msg, int wrap, const char* data) {
+  uint32_t start = StartPosition(t, msg, wrap);
+  Result r = Measure([&]() {
+    // Stands in for a reader that drains the buffer instantly.
+    t->tx_tail = t->tx_head = start;
+    return buffy_tx(t, data, msg);
+  });
+  Print("tx", t, msg, wrap, r);
+}
+
+void BenchTxBufferRead(struct buffy* t, int msg, int wrap, char* data) {
+  uint32_t start = StartPosition(t, msg, wrap);
+  Result r = Measure([&]() {
+    t->tx_tail = start;
+    t->tx_head = start + msg;
+    return buffy_tx_buffer_read(t, data, msg);
+  });
+  Print("tx_buffer_read", t, msg, wrap, r);
+}
+
+void BenchRx(struct buffy* t, int msg, int wrap, char* data) {
+  uint32_t start = StartPosition(t, msg, wrap);
+  Result r = Measure([&]() {
+    t->rx_tail = start;
+    t->rx_head = start + msg;
+    return buffy_rx(t, data, msg);
+  });
+  Print("rx", t, msg, wrap, r);
+}
+
+// buffy_tx from one thread while another one keeps reading the buffer out,
+// like a debugger polling the target would. Runs for min_time_ns after the
+// reader has started.
+void BenchTxConcurrent(struct buffy* t, int msg, const char* data) {
+  t->tx_tail = t->tx_head = 0;
+  std::atomic<bool> started{false};
+  std::atomic<bool> done{false};
+  std::thread reader([&]() {
+    std::vector<char> out(buffy_tx_get_buffer_size(t));
+    started.store(true, std::memory_order_release);
+    while (!done.load(std::memory_order_acquire)) {
+      if (buffy_tx_buffer_read(t, out.data(), out.size()) == 0) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  while (!started.load(std::memory_order_acquire)) std::this_thread::yield();
+
+  Result r;
+  Clock::time_point start = Clock::now();
+  while (r.ns < min_time_ns) {
+    for (int i = 0; i < 1024; i++) {
+      int written = buffy_tx(t, data, msg);
+      r.bytes += written;
+      r.dropped += msg - written;
+    }
+    r.calls += 1024;
+    r.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                start)
+               .count();
+  }
+  done.store(true, std::memory_order_release);
+  reader.join();
+  Print("tx_concurrent", t, msg, 0, r);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc > 1) min_time_ns = atoll(argv[1]) * 1000 * 1000;
+  std::vector<char> data(kMessageSizes[sizeof(kMessageSizes) /
+                                       sizeof(kMessageSizes[0]) - 1]);
+  for (size_t i = 0; i < data.size(); i++) data[i] = i;
+
+  printf("op,buffer,msg,wrap,calls,bytes,dropped,ns_per_call,ns_per_byte\n");
+  for (struct buffy* t : kBuffies) {
+    for (int msg : kMessageSizes) {
+      if (msg > buffy_tx_get_buffer_size(t)) continue;
+      // A single byte can't straddle the end of the buffer.
+      for (int wrap = 0; wrap <= (msg > 1); wrap++) {
+        BenchTx(t, msg, wrap, data.data());
+        BenchTxBufferRead(t, msg, wrap, data.data());
+        BenchRx(t, msg, wrap, data.data());
+      }
+      BenchTxConcurrent(t, msg, data.data());
+    }
+  }
+  return 0;
+}
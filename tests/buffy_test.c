@@ -5,19 +5,14 @@
 
 #include <cutest.h>
 
-#define TEST_EQ(a, b)                          \
-  do {                                         \
-    typeof(a) _a = (a);                        \
-    typeof(b) _b = (b);                        \
-    TEST_CHECK_(_a == _b, "%d != %d", _a, _b); \
-  } while (0)
+#include "test_util.h"
 
 void test_tx(void) {
   // Note, the define in Makefile sets TX buffer to 16B.
   INSTANTIATE_BUFFY(buffy);
   TEST_EQ(buffy.tx_head, 0);
   TEST_EQ(buffy.tx_tail, 0);
-  TEST_EQ(buffy_tx_get_buffer_size(&buffy), 15);
+  TEST_EQ(buffy_tx_get_buffer_size(&buffy), 16);
 
   TEST_EQ(buffy_tx(&buffy, "wahhh", 5), 5);
   TEST_EQ(buffy.tx_head, 5);
@@ -28,40 +23,270 @@ void test_tx(void) {
   TEST_EQ(buffy.tx_tail, 0);
 
   TEST_EQ(buffy.tx_overflow_counter, 0);
-  TEST_EQ(buffy_tx(&buffy, "123456789abcdefg", 16), 16 - 5 - 3 - 1);
+  TEST_EQ(buffy_tx(&buffy, "123456789abcdefg", 16), 16 - 5 - 3);
   TEST_EQ(buffy.tx_overflow_counter, 1);
+  TEST_EQ(buffy.tx_dropped_bytes, 8);
+  TEST_EQ(buffy.tx_dropped_records, 0);
 
   TEST_EQ(buffy_tx(&buffy, "123456789abcdefg", 16), 0);
   TEST_EQ(buffy.tx_overflow_counter, 2);
+  TEST_EQ(buffy.tx_dropped_bytes, 8 + 16);
+  TEST_EQ(buffy.tx_dropped_records, 1);
 
   buffy.tx_tail = 1;
   TEST_EQ(buffy_tx(&buffy, "123456789abcdefg", 16), 1);
   TEST_EQ(buffy.tx_overflow_counter, 3);
+  TEST_EQ(buffy.tx_dropped_bytes, 8 + 16 + 15);
+  TEST_EQ(buffy.tx_dropped_records, 1);
 
   // Safety checks - if tail or head is messed up, make sure buffy returns
   // 0 and resets.
-  buffy.tx_tail = 16;  // One past the end.
+  buffy.tx_tail = 20;  // Past head.
   buffy.tx_head = 3;
   TEST_EQ(buffy_tx(&buffy, "123456789abcdefg", 16), 0);
   TEST_EQ(buffy.tx_tail, 0);
   TEST_EQ(buffy.tx_head, 0);
 
-  // Move head past the end.
-  buffy.tx_head = 16;  // One outside the bounds.
+  // Move head more than a buffer ahead of tail.
+  buffy.tx_head = 20;
   buffy.tx_tail = 3;
   TEST_EQ(buffy_tx(&buffy, "123456789abcdefg123456789abcdefg", 32), 0);
   TEST_EQ(buffy.tx_tail, 0);
   TEST_EQ(buffy.tx_tail, 0);
+
+  // Heads and tails are free-running, make sure they wrap around cleanly.
+  buffy.tx_head = 0xfffffffe;
+  buffy.tx_tail = 0xfffffffe;
+  TEST_EQ(buffy_tx(&buffy, "wrap!", 5), 5);
+  TEST_EQ(buffy.tx_head, 3);
+  TEST_EQ(buffy_tx_get_buffer_free(&buffy), 11);
+  TEST_EQ(0, memcmp(buffy.tx_buf + 14, "wr", 2));
+  TEST_EQ(0, memcmp(buffy.tx_buf, "ap!", 3));
 }
 
+void test_tx_reserve(void) {
+  INSTANTIATE_BUFFY(buffy);
+  struct buffy_span span1, span2;
+
+  TEST_EQ(buffy_tx_reserve(&buffy, 10, &span1, &span2), 10);
+  TEST_EQ(span1.len, 10);
+  TEST_EQ(span2.len, 0);
+  TEST_CHECK(span1.buf == buffy.tx_buf);
+  memcpy(span1.buf, "helloworld", 10);
+  // Nothing is visible until commit.
+  TEST_EQ(buffy.tx_head, 0);
+#if BUFFY_MULTI_PRODUCER
+  buffy_tx_commit(&buffy, 10);
+  TEST_EQ(buffy.tx_head, 10);
+  buffy.tx_tail = 5;
+  TEST_EQ(buffy_tx_reserve(&buffy, 11, &span1, &span2), 11);
+  buffy_tx_commit(&buffy, 11);
+  TEST_EQ(buffy.tx_head, 21);
+  TEST_EQ(buffy_tx_buffer_read(&buffy, (char[16]){0}, 16), 16);
+#else
+  // Only committed bytes get published.
+  buffy_tx_commit(&buffy, 5);
+  TEST_EQ(buffy.tx_head, 5);
+#endif
+  TEST_EQ(buffy.tx_overflow_counter, 0);
+
+  // Wrap around: 11 bytes to the end of the buffer, 5 from the start.
+  buffy.tx_head = 5;
+  buffy.tx_tail = 5;
+  TEST_EQ(buffy_tx_reserve(&buffy, 17, &span1, &span2), 16);
+  TEST_EQ(buffy.tx_overflow_counter, 1);
+  TEST_CHECK(span1.buf == buffy.tx_buf + 5);
+  TEST_EQ(span1.len, 11);
+  TEST_CHECK(span2.buf == buffy.tx_buf);
+  TEST_EQ(span2.len, 5);
+  memcpy(span1.buf, "0123456789a", 11);
+  memcpy(span2.buf, "bcdef", 5);
+  buffy_tx_commit(&buffy, 16);
+  TEST_EQ(buffy.tx_head, 21);
+
+  char out[16];
+  TEST_EQ(buffy_tx_buffer_read(&buffy, out, 16), 16);
+  TEST_EQ(0, memcmp(out, "0123456789abcdef", 16));
+
+  // Out of bounds tail gets reset, nothing is reserved.
+  buffy.tx_tail = 40;
+  TEST_EQ(buffy_tx_reserve(&buffy, 4, &span1, &span2), 0);
+  TEST_EQ(span1.len, 0);
+  TEST_EQ(span2.len, 0);
+  TEST_EQ(buffy.tx_head, 0);
+  TEST_EQ(buffy.tx_tail, 0);
+}
+
+#if BUFFY_MULTI_PRODUCER
+void test_tx_nested_writers(void) {
+  INSTANTIATE_BUFFY(buffy);
+  struct buffy_span outer1, outer2, inner1, inner2;
+
+  // A thread reserves space, then gets interrupted by an ISR that writes a
+  // record of its own before the thread is done.
+  TEST_EQ(buffy_tx_reserve(&buffy, 4, &outer1, &outer2), 4);
+  TEST_EQ(buffy_tx_get_buffer_free(&buffy), 12);
+  TEST_EQ(buffy_tx_reserve(&buffy, 3, &inner1, &inner2), 3);
+  TEST_EQ(buffy_tx_get_buffer_free(&buffy), 9);
+  TEST_CHECK(inner1.buf == outer1.buf + 4);
+  memcpy(inner1.buf, "isr", 3);
+  buffy_tx_commit(&buffy, 3);
+  // Can't publish the ISR's data while the thread's record is incomplete.
+  TEST_EQ(buffy.tx_head, 0);
+  TEST_EQ(buffy_tx(&buffy, "!", 1), 1);
+  TEST_EQ(buffy.tx_head, 0);
+
+  memcpy(outer1.buf, "thrd", 4);
+  buffy_tx_commit(&buffy, 4);
+  // The outermost writer publishes everything.
+  TEST_EQ(buffy.tx_head, 8);
+  TEST_EQ(buffy.tx_writers & 0xffff, 0);
+
+  char out[16];
+  TEST_EQ(buffy_tx_buffer_read(&buffy, out, 16), 8);
+  TEST_EQ(0, memcmp(out, "thrdisr!", 8));
+}
+
+// Writes a record from "an interrupt" at the preempt_at'th atomic operation.
+static struct buffy* preempt_buffy;
+static int preempt_at;
+static int preempt_count;
+
+static void preempt_with_isr(void) {
+  if (++preempt_count != preempt_at) return;
+  TEST_EQ(buffy_tx(preempt_buffy, "ISR", 3), 3);
+}
+
+// Interrupts a writer at every atomic operation of its TX call, including
+// the ones that register and unregister it, and checks that both records
+// make it out whole.
+void test_tx_preempted(void) {
+  for (preempt_at = 1;; preempt_at++) {
+    INSTANTIATE_BUFFY(buffy);
+    preempt_buffy = &buffy;
+    preempt_count = 0;
+    buffy_test_preempt_hook = preempt_with_isr;
+    TEST_EQ(buffy_tx(&buffy, "thread", 6), 6);
+    buffy_test_preempt_hook = NULL;
+    int preempted = preempt_count >= preempt_at;
+
+    char out[16] = {0};
+    int n = buffy_tx_buffer_read(&buffy, out, sizeof(out));
+    TEST_EQ(buffy.tx_writers & 0xffff, 0);
+    if (!preempted) {
+      TEST_EQ(n, 6);
+      break;
+    }
+    TEST_EQ(n, 9);
+    TEST_CHECK_(memcmp(out, "threadISR", 9) == 0 ||
+                    memcmp(out, "ISRthread", 9) == 0,
+                "preempted at %d: %.9s", preempt_at, out);
+  }
+  // At least registering, reserving and unregistering.
+  TEST_CHECK(preempt_at > 3);
+}
+#endif  // BUFFY_MULTI_PRODUCER
+
+#if !BUFFY_MULTI_PRODUCER
+void test_tx_overwrite(void) {
+  INSTANTIATE_BUFFY_FLIGHT_RECORDER(buffy);
+  // Each record takes 2 extra bytes for the length.
+  TEST_EQ(buffy_tx(&buffy, "hello", 5), 5);
+  TEST_EQ(buffy.tx_head, 7);
+  TEST_EQ(buffy_tx(&buffy, "world!", 6), 6);
+  TEST_EQ(buffy.tx_head, 15);
+  TEST_EQ(buffy.tx_tail, 0);
+
+  // Full, the oldest record is dropped to make room.
+  TEST_EQ(buffy_tx(&buffy, "abc", 3), 3);
+  TEST_EQ(buffy.tx_head, 20);
+  TEST_EQ(buffy.tx_tail, 7);
+  TEST_EQ(buffy.tx_records, 3);
+  TEST_EQ(buffy.tx_overflow_counter, 0);
+
+  // Drops as many records as needed, the tail always lands on a record.
+  TEST_EQ(buffy_tx(&buffy, "01234567", 8), 8);
+  TEST_EQ(buffy.tx_tail, 15);
+  TEST_EQ(buffy.tx_head, 30);
+
+  // Reads stop at the last whole record that fits.
+  char out[16];
+  TEST_EQ(buffy_tx_buffer_read(&buffy, out, 9), 5);
+  TEST_EQ(0, memcmp(out, "\x03\x00" "abc", 5));
+  TEST_EQ(buffy.tx_tail, 20);
+  TEST_EQ(buffy_tx_buffer_read(&buffy, out, 4), 0);
+  TEST_EQ(buffy_tx_buffer_read(&buffy, out, 16), 10);
+  TEST_EQ(0, memcmp(out, "\x08\x00" "01234567", 10));
+
+  // Records that can never fit are dropped.
+  buffy.tx_tail = buffy.tx_head;
+  TEST_EQ(buffy_tx(&buffy, "123456789abcdef", 15), 0);
+  TEST_EQ(buffy.tx_overflow_counter, 1);
+  TEST_EQ(buffy.tx_records, 4);
+}
+
+// Wait hook that plays the host: drains wait_drain bytes per call.
+static struct buffy* wait_buffy;
+static int wait_drain;
+static int wait_calls;
+
+static void drain_some(void) {
+  char out[16];
+  wait_calls++;
+  buffy_tx_buffer_read(wait_buffy, out, wait_drain);
+}
+
+void test_tx_wait(void) {
+  INSTANTIATE_BUFFY(buffy);
+  wait_buffy = &buffy;
+  wait_calls = 0;
+  wait_drain = 4;
+  buffy_set_wait_hook(&buffy, drain_some, 3);
+  char out[16];
+
+  // No host has drained anything yet, so no waiting.
+  TEST_EQ(buffy_tx(&buffy, "0123456789abcdef", 16), 16);
+  TEST_EQ(buffy_tx(&buffy, "x", 1), 0);
+  TEST_EQ(wait_calls, 0);
+  TEST_EQ(buffy.tx_dropped_bytes, 1);
+
+  // Once it has, writes wait for room.
+  TEST_EQ(buffy_tx_buffer_read(&buffy, out, 2), 2);
+  TEST_EQ(buffy_tx(&buffy, "ghijkl", 6), 6);
+  TEST_EQ(wait_calls, 1);
+  TEST_EQ(buffy_tx_all(&buffy, "mnopqrst", 8), 8);
+  TEST_EQ(wait_calls, 3);
+  TEST_EQ(buffy.tx_dropped_bytes, 1);
+
+  // The host stops draining: give up after 3 waits and drop.
+  wait_drain = 0;
+  TEST_EQ(buffy_tx(&buffy, "uv", 2), 0);
+  TEST_EQ(wait_calls, 6);
+  TEST_EQ(buffy.tx_dropped_bytes, 3);
+  // Don't wait again until the host is back.
+  TEST_EQ(buffy_tx(&buffy, "uv", 2), 0);
+  TEST_EQ(wait_calls, 6);
+  TEST_EQ(buffy_tx_buffer_read(&buffy, out, 1), 1);
+  wait_drain = 4;
+  TEST_EQ(buffy_tx(&buffy, "uv", 2), 2);
+  TEST_EQ(wait_calls, 7);
+
+  // Writes larger than the buffer wait for it to empty, then get truncated.
+  wait_drain = 8;
+  TEST_EQ(buffy_tx(&buffy, "0123456789abcdefXYZ", 19), 16);
+  TEST_EQ(wait_calls, 9);
+  TEST_EQ(buffy.tx_dropped_bytes, 3 + 2 + 3);
+}
+#endif  // !BUFFY_MULTI_PRODUCER
+
 void test_tx_get_buffer_free(void) {
   INSTANTIATE_BUFFY(buffy);
-  TEST_EQ(buffy_tx_get_buffer_free(&buffy), 15);
+  TEST_EQ(buffy_tx_get_buffer_free(&buffy), 16);
   TEST_EQ(buffy_tx(&buffy, "wahhh", 5), 5);
-  TEST_EQ(buffy_tx_get_buffer_free(&buffy), 10);
+  TEST_EQ(buffy_tx_get_buffer_free(&buffy), 11);
   TEST_EQ(buffy_tx(&buffy, "foo", 3), 3);
-  TEST_EQ(buffy_tx_get_buffer_free(&buffy), 7);
-  TEST_EQ(buffy_tx(&buffy, "123456789abcdef", 16), 16 - 5 - 3 - 1);
+  TEST_EQ(buffy_tx_get_buffer_free(&buffy), 8);
+  TEST_EQ(buffy_tx(&buffy, "123456789abcdefg", 16), 16 - 5 - 3);
   TEST_EQ(buffy_tx_get_buffer_free(&buffy), 0);
   buffy.tx_tail = 1;
   TEST_EQ(buffy_tx_get_buffer_free(&buffy), 1);
@@ -71,13 +296,59 @@ void test_tx_get_buffer_free(void) {
   TEST_EQ(buffy_tx_get_buffer_free(&buffy), 3);
 }
 
+void test_tx_all(void) {
+  INSTANTIATE_BUFFY(buffy);
+  TEST_EQ(buffy_tx_all(&buffy, "123456789abc", 12), 12);
+  TEST_EQ(buffy.tx_head, 12);
+
+  // Doesn't fit, nothing gets written.
+  TEST_EQ(buffy_tx_all(&buffy, "defgh", 5), 0);
+  TEST_EQ(buffy.tx_head, 12);
+  TEST_EQ(buffy.tx_overflow_counter, 1);
+  TEST_EQ(buffy.tx_dropped_bytes, 5);
+  TEST_EQ(buffy.tx_dropped_records, 1);
+
+  TEST_EQ(buffy_tx_all(&buffy, "defg", 4), 4);
+  TEST_EQ(buffy_tx_get_buffer_free(&buffy), 0);
+
+  char out[16];
+  TEST_EQ(buffy_tx_buffer_read(&buffy, out, 16), 16);
+  TEST_EQ(0, memcmp(out, "123456789abcdefg", 16));
+}
+
+void test_txv(void) {
+  INSTANTIATE_BUFFY(buffy);
+  const struct buffy_iovec record[] = {
+      {"hdr:", 4},
+      {"payload", 7},
+      {"", 0},
+      {"!", 1},
+  };
+  TEST_EQ(buffy_txv(&buffy, record, 4), 12);
+  TEST_EQ(buffy.tx_head, 12);
+
+  // Only 4 bytes left, all or nothing.
+  TEST_EQ(buffy_txv(&buffy, record, 2), 0);
+  TEST_EQ(buffy.tx_head, 12);
+  TEST_EQ(buffy.tx_overflow_counter, 1);
+
+  char out[16];
+  TEST_EQ(buffy_tx_buffer_read(&buffy, out, 16), 12);
+  TEST_EQ(0, memcmp(out, "hdr:payload!", 12));
+
+  // Wraps around the end of the buffer.
+  TEST_EQ(buffy_txv(&buffy, record, 2), 11);
+  TEST_EQ(buffy_tx_buffer_read(&buffy, out, 16), 11);
+  TEST_EQ(0, memcmp(out, "hdr:payload", 11));
+}
+
 void test_tx_buffer_read(void) {
   INSTANTIATE_BUFFY(buffy);
-  TEST_EQ(buffy_tx(&buffy, "123456789abcdef", 16), 15);
+  TEST_EQ(buffy_tx(&buffy, "123456789abcdefg", 16), 16);
 
   char out[16];
-  TEST_EQ(15, buffy_tx_buffer_read(&buffy, out, 16));
-  TEST_EQ(0, memcmp(out, "123456789abcdef", 15));
+  TEST_EQ(16, buffy_tx_buffer_read(&buffy, out, 16));
+  TEST_EQ(0, memcmp(out, "123456789abcdefg", 16));
 
   TEST_EQ(buffy_tx(&buffy, "feefoo", 6), 6);
   TEST_EQ(buffy_tx(&buffy, "bar", 3), 3);
@@ -86,6 +357,88 @@ void test_tx_buffer_read(void) {
   TEST_EQ(0, memcmp(out, "feefoobar", 9));
 }
 
+// Goes through every combination of source alignment, buffer position and
+// length, to cover all the paths through the copy routine.
+void test_copy_alignments(void) {
+  INSTANTIATE_BUFFY_SIZED(buffy, 128, 8);
+  char in[80 + 4], out[80 + 4];
+  for (int i = 0; i < (int)sizeof(in); i++) in[i] = i;
+  for (int src = 0; src < 4; src++) {
+    for (uint32_t pos = 100; pos < 108; pos++) {
+      for (int len = 0; len <= 80; len++) {
+        buffy.tx_tail = buffy.tx_head = pos;
+        TEST_EQ(buffy_tx(&buffy, in + src, len), len);
+        memset(out, 0xaa, sizeof(out));
+        TEST_EQ(buffy_tx_buffer_read(&buffy, out + 3 - src, len), len);
+        TEST_CHECK_(memcmp(in + src, out + 3 - src, len) == 0,
+                    "src %d pos %u len %d", src, pos, len);
+        // Nothing outside of the destination got written.
+        TEST_EQ((uint8_t)out[3 - src + len], 0xaa);
+      }
+    }
+  }
+}
+
+// Writes len bytes to the RX buffer, like the host would.
+static void host_write(struct buffy* buffy, const char* data, int len) {
+  int rx_size = 1 << buffy->rx_len_pow2;
+  for (int i = 0; i < len; i++) {
+    buffy->rx_buf[(buffy->rx_head + i) % rx_size] = data[i];
+  }
+  buffy->rx_head += len;
+}
+
+// Sends and receives messages of all lengths up to the buffer sizes at every
+// position, so that each of them wraps around at some point.
+static void check_wrapping(struct buffy* buffy) {
+  int tx_size = buffy_tx_get_buffer_size(buffy);
+  int rx_size = 1 << buffy->rx_len_pow2;
+  char in[64], out[64];
+  for (int i = 0; i < (int)sizeof(in); i++) in[i] = 'a' + i % 26;
+  for (int len = 1; len <= tx_size; len++) {
+    for (int i = 0; i < tx_size; i++) {
+      TEST_EQ(buffy_tx(buffy, in + i % 8, len), len);
+      TEST_EQ(buffy_tx_buffer_read(buffy, out, len), len);
+      TEST_CHECK_(memcmp(in + i % 8, out, len) == 0, "tx len %d i %d", len, i);
+    }
+  }
+  for (int len = 1; len <= rx_size; len++) {
+    for (int i = 0; i < rx_size; i++) {
+      host_write(buffy, in, len);
+      TEST_EQ(buffy_rx(buffy, out, len), len);
+      TEST_CHECK_(memcmp(in, out, len) == 0, "rx len %d i %d", len, i);
+    }
+  }
+}
+
+void test_buffer_sizes(void) {
+  // The default sizes take the specialized code, the rest the generic code.
+  INSTANTIATE_BUFFY(buffy);
+  check_wrapping(&buffy);
+  INSTANTIATE_BUFFY_SIZED(larger, 32, 16);
+  check_wrapping(&larger);
+  INSTANTIATE_BUFFY_SIZED(mixed, BUFFY_TX_BUF_SIZE, 2 * BUFFY_RX_BUF_SIZE);
+  check_wrapping(&mixed);
+}
+
+void test_root(void) {
+  INSTANTIATE_BUFFY_SIZED(radio, 64, 4);
+  INSTANTIATE_BUFFY(power);
+  INSTANTIATE_BUFFY_ROOT(root, BUFFY_CHANNEL(radio), BUFFY_CHANNEL(power));
+
+  TEST_EQ(root.magic, BUFFY_ROOT_MAGIC);
+  TEST_EQ(root.channel_count, 2);
+  TEST_EQ(strcmp(root.channels[0].name, "radio"), 0);
+  TEST_CHECK(root.channels[0].buffy == &radio);
+  TEST_EQ(strcmp(root.channels[1].name, "power"), 0);
+  TEST_CHECK(root.channels[1].buffy == &power);
+
+  // Channels have their own sizes.
+  TEST_EQ(buffy_tx_get_buffer_size(&radio), 64);
+  TEST_EQ(radio.rx_len_pow2, 2);
+  TEST_EQ(buffy_tx_get_buffer_size(&power), 16);
+}
+
 void test_rx(void) {
   INSTANTIATE_BUFFY(buffy);
 
@@ -103,7 +456,7 @@ void test_rx(void) {
   TEST_EQ(buf[0], 'a');
   TEST_EQ(buf[1], 'b');
 
-  buffy.rx_head = 1;
+  buffy.rx_head = 9;
 
   TEST_EQ(buffy_rx(&buffy, buf, 8), 7);
   TEST_EQ(buf[0], 'c');
@@ -112,22 +465,151 @@ void test_rx(void) {
 
   // Safety checks - if tail or head is messed up, make sure buffy returns
   // 0 and resets.
-  buffy.rx_tail = 9;  // One past the end.
+  buffy.rx_tail = 9;  // Past head.
   buffy.rx_head = 3;
   TEST_EQ(buffy_rx(&buffy, buf, 8), 0);
   TEST_EQ(buffy.rx_tail, 0);
   TEST_EQ(buffy.rx_head, 0);
 
-  // Move head past the end.
-  buffy.rx_head = 9;  // One outside the bounds.
+  // Move head more than a buffer ahead of tail.
+  buffy.rx_head = 12;
   buffy.rx_tail = 3;
   TEST_EQ(buffy_rx(&buffy, buf, 8), 0);
   TEST_EQ(buffy.rx_tail, 0);
   TEST_EQ(buffy.rx_tail, 0);
 }
 
+void test_rx_peek(void) {
+  INSTANTIATE_BUFFY(buffy);
+  struct buffy_span span1, span2;
+  TEST_EQ(buffy_rx_peek(&buffy, &span1, &span2), 0);
+  TEST_EQ(span1.len, 0);
+  TEST_EQ(span2.len, 0);
+
+  host_write(&buffy, "abcdef", 6);
+  TEST_EQ(buffy_rx_peek(&buffy, &span1, &span2), 6);
+  TEST_CHECK(span1.buf == buffy.rx_buf);
+  TEST_EQ(span1.len, 6);
+  TEST_EQ(span2.len, 0);
+  // Peeking again returns the same data until it's consumed.
+  TEST_EQ(buffy_rx_peek(&buffy, &span1, &span2), 6);
+  buffy_rx_consume(&buffy, 4);
+  TEST_EQ(buffy.rx_tail, 4);
+
+  // Wrap around: 4 bytes to the end of the buffer, 2 from the start.
+  host_write(&buffy, "ghij", 4);
+  TEST_EQ(buffy_rx_peek(&buffy, &span1, &span2), 6);
+  TEST_CHECK(span1.buf == buffy.rx_buf + 4);
+  TEST_EQ(span1.len, 4);
+  TEST_CHECK(span2.buf == buffy.rx_buf);
+  TEST_EQ(span2.len, 2);
+  TEST_EQ(0, memcmp(span1.buf, "efgh", 4));
+  TEST_EQ(0, memcmp(span2.buf, "ij", 2));
+  buffy_rx_consume(&buffy, 6);
+  TEST_EQ(buffy_rx_peek(&buffy, &span1, &span2), 0);
+
+  // Out of bounds head gets reset.
+  buffy.rx_head = 100;
+  TEST_EQ(buffy_rx_peek(&buffy, &span1, &span2), 0);
+  TEST_EQ(buffy.rx_head, 0);
+  TEST_EQ(buffy.rx_tail, 0);
+}
+
+// Last command handled by record_command().
+static struct {
+  int calls;
+  int id;
+  const uint8_t* data;
+  char copy[16];
+  int len;
+} last_command;
+
+static void record_command(int id, const uint8_t* data, int len) {
+  last_command.calls++;
+  last_command.id = id;
+  last_command.data = data;
+  memcpy(last_command.copy, data, len);
+  last_command.len = len;
+}
+
+static void command1(struct buffy* t, const uint8_t* data, int len) {
+  record_command(1, data, len);
+}
+
+static void command2(struct buffy* t, const uint8_t* data, int len) {
+  record_command(2, data, len);
+}
+
+void test_rx_poll(void) {
+  // Note, the define in Makefile sets RX buffer to 8B.
+  INSTANTIATE_BUFFY(buffy);
+  const struct buffy_command commands[] = {{1, command1}, {2, command2}};
+  memset(&last_command, 0, sizeof(last_command));
+  TEST_EQ(buffy_rx_poll(&buffy, commands, 2), 0);
+
+  // Parsed in place.
+  host_write(&buffy, "\x01\x00\x02\x00" "hi", 6);
+  TEST_EQ(buffy_rx_poll(&buffy, commands, 2), 1);
+  TEST_EQ(last_command.id, 1);
+  TEST_EQ(last_command.len, 2);
+  TEST_EQ(0, memcmp(last_command.copy, "hi", 2));
+  TEST_CHECK(last_command.data == buffy.rx_buf + 4);
+  TEST_EQ(buffy.rx_tail, 6);
+
+  // Nothing happens until the whole frame is there. The header wraps around.
+  host_write(&buffy, "\x02\x00\x03\x00", 4);
+  TEST_EQ(buffy_rx_poll(&buffy, commands, 2), 0);
+  TEST_EQ(buffy.rx_tail, 6);
+  host_write(&buffy, "abc", 3);
+  TEST_EQ(buffy_rx_poll(&buffy, commands, 2), 1);
+  TEST_EQ(last_command.id, 2);
+  TEST_EQ(last_command.len, 3);
+  TEST_EQ(0, memcmp(last_command.copy, "abc", 3));
+  TEST_EQ(buffy.rx_tail, 13);
+
+  // Unknown commands are skipped. The second frame's data wraps around and
+  // gets copied.
+  host_write(&buffy, "\x07\x00\x01\x00" "x", 5);
+  TEST_EQ(buffy_rx_poll(&buffy, commands, 2), 0);
+  TEST_EQ(buffy.rx_tail, 18);
+  host_write(&buffy, "\x01\x00\x04\x00" "wrap", 8);
+  TEST_EQ(buffy_rx_poll(&buffy, commands, 2), 1);
+  TEST_EQ(last_command.len, 4);
+  TEST_EQ(0, memcmp(last_command.copy, "wrap", 4));
+  TEST_CHECK(last_command.data < buffy.rx_buf ||
+             last_command.data >= buffy.rx_buf + BUFFY_RX_BUF_SIZE);
+  TEST_EQ(buffy.rx_tail, 26);
+
+  // Empty commands.
+  host_write(&buffy, "\x02\x00\x00\x00\x01\x00\x00\x00", 8);
+  TEST_EQ(buffy_rx_poll(&buffy, commands, 2), 2);
+  TEST_EQ(last_command.id, 1);
+  TEST_EQ(last_command.len, 0);
+  TEST_EQ(last_command.calls, 5);
+
+  // A frame that can't ever fit, everything is dropped.
+  host_write(&buffy, "\x01\x00\x05\x00" "abc", 7);
+  TEST_EQ(buffy_rx_poll(&buffy, commands, 2), 0);
+  TEST_EQ(buffy.rx_tail, buffy.rx_head);
+}
+
 TEST_LIST = {{"test_tx", test_tx},
              {"text_rx", test_rx},
+             {"test_rx_peek", test_rx_peek},
+             {"test_rx_poll", test_rx_poll},
+             {"test_tx_reserve", test_tx_reserve},
+             {"test_tx_all", test_tx_all},
+             {"test_txv", test_txv},
              {"test_tx_buffer_read", test_tx_buffer_read},
              {"test_tx_get_buffer_free", test_tx_get_buffer_free},
+             {"test_copy_alignments", test_copy_alignments},
+             {"test_buffer_sizes", test_buffer_sizes},
+             {"test_root", test_root},
+#if BUFFY_MULTI_PRODUCER
+             {"test_tx_nested_writers", test_tx_nested_writers},
+             {"test_tx_preempted", test_tx_preempted},
+#else
+             {"test_tx_overwrite", test_tx_overwrite},
+             {"test_tx_wait", test_tx_wait},
+#endif
              {0}};
@@ -0,0 +1,130 @@
+// Per-call cost of buffy_tx on a Cortex-M, meant to run under QEMU (see
+// Makefile), or on real hardware with a semihosting debugger attached.
+//
+// Prints one CSV line per measurement over semihosting:
+//
+//   op,buffer,msg,wrap,calls,counter,per_call
+//
+// counter: "cycles" if the DWT cycle counter works (real hardware), else
+//          "instructions": QEMU doesn't implement the DWT, so we count SysTick
+//          ticks instead, which under "-icount shift=0" advance once every
+//          kNsPerTick instructions. QEMU does not model pipeline stalls or
+//          wait states, so on QEMU this is an instruction count, e.g. a dsb
+//          costs the same as a nop.
+// per_call: counter per buffy_tx call, with the cost of the measurement loop
+//          itself subtracted, in hundredths.
+
+#include <stdint.h>
+
+#include "buffy.h"
+#include "semihosting.h"
+
+#define DEMCR (*(volatile uint32_t*)0xe000edfc)
+#define DWT_CTRL (*(volatile uint32_t*)0xe0001000)
+#define DWT_CYCCNT (*(volatile uint32_t*)0xe0001004)
+#define SYST_CSR (*(volatile uint32_t*)0xe000e010)
+#define SYST_RVR (*(volatile uint32_t*)0xe000e014)
+#define SYST_CVR (*(volatile uint32_t*)0xe000e018)
+
+// SysTick runs off the 25 MHz system clock on the AN385, so it ticks every
+// 40 ns of virtual time, i.e. every 40 instructions with -icount shift=0.
+static const uint32_t kNsPerTick = 40;
+static const int kCalls = 256;
+static const int kMessageSizes[] = {1, 4, 16, 64, 256, 1024, 4096};
+
+INSTANTIATE_BUFFY_SIZED(channel, 8192, 64);
+static char data[4096];
+
+static int use_dwt;
+
+static void counter_init(void) {
+  DEMCR |= 1 << 24;  // TRCENA
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= 1;  // CYCCNTENA
+  uint32_t start = DWT_CYCCNT;
+  for (volatile int i = 0; i < 100; i++) {
+  }
+  use_dwt = DWT_CYCCNT != start;
+
+  SYST_RVR = 0xffffff;
+  SYST_CVR = 0;
+  SYST_CSR = 5;  // Enabled, processor clock, no interrupt.
+}
+
+static uint32_t counter_read(void) {
+  return use_dwt ? DWT_CYCCNT : SYST_CVR;
+}
+
+static uint32_t counter_elapsed(uint32_t start, uint32_t end) {
+  if (use_dwt) return end - start;
+  // SysTick counts down and is 24 bits wide.
+  return ((start - end) & 0xffffff) * kNsPerTick;
+}
+
+// Runs kCalls calls starting at the given buffer position, returns the total
+// counter value. With msg == 0, only measures the loop overhead.
+static uint32_t run(uint32_t start, int msg) {
+  uint32_t begin = counter_read();
+  for (int i = 0; i < kCalls; i++) {
+    // Stands in for a reader that drains the buffer instantly.
+    channel.tx_tail = channel.tx_head = start;
+    if (msg) buffy_tx(&channel, data, msg);
+  }
+  return counter_elapsed(begin, counter_read());
+}
+
+static char* append(char* p, const char* s) {
+  while (*s) *p++ = *s++;
+  return p;
+}
+
+static char* append_uint(char* p, uint32_t value) {
+  char digits[10];
+  int n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (n) *p++ = digits[--n];
+  return p;
+}
+
+static void print_result(int msg, int wrap, uint32_t total,
+                         uint32_t overhead) {
+  uint32_t net = total > overhead ? total - overhead : 0;
+  uint32_t per_call = (uint64_t)net * 100 / kCalls;
+  char line[128];
+  char* p = append(line, "tx,");
+  p = append_uint(p, buffy_tx_get_buffer_size(&channel));
+  p = append(p, ",");
+  p = append_uint(p, msg);
+  p = append(p, wrap ? ",1," : ",0,");
+  p = append_uint(p, kCalls);
+  p = append(p, use_dwt ? ",cycles," : ",instructions,");
+  p = append_uint(p, per_call / 100);
+  p = append(p, ".");
+  if (per_call % 100 < 10) p = append(p, "0");
+  p = append_uint(p, per_call % 100);
+  p = append(p, "\n");
+  *p = 0;
+  semihosting_write(line);
+}
+
+int main(void) {
+  for (unsigned i = 0; i < sizeof(data); i++) data[i] = i;
+  counter_init();
+
+  semihosting_write("op,buffer,msg,wrap,calls,counter,per_call\n");
+  uint32_t overhead = run(0, 0);
+  for (unsigned i = 0; i < sizeof(kMessageSizes) / sizeof(kMessageSizes[0]);
+       i++) {
+    int msg = kMessageSizes[i];
+    print_result(msg, 0, run(0, msg), overhead);
+    // Straddles the end of the buffer, so buffy_tx copies two segments.
+    if (msg > 1) {
+      uint32_t start = buffy_tx_get_buffer_size(&channel) - msg / 2;
+      print_result(msg, 1, run(start, msg), overhead);
+    }
+  }
+  return 0;
+}
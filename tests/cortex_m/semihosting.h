@@ -0,0 +1,7 @@
+#pragma once
+
+// Prints a NUL-terminated string on the host's stdout.
+void semihosting_write(const char* s);
+
+// Stops the emulator. Non-zero status makes QEMU exit with an error.
+void semihosting_exit(int status) __attribute__((noreturn));
@@ -0,0 +1,55 @@
+// Minimal startup for running the benchmark under QEMU: vector table, .data
+// and .bss setup, and semihosting for output.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "semihosting.h"
+
+extern uint32_t _data_start, _data_end, _data_load, _bss_start, _bss_end;
+extern uint32_t _stack_top;
+
+int main(void);
+
+void reset_handler(void) {
+  memcpy(&_data_start, &_data_load,
+         (uintptr_t)&_data_end - (uintptr_t)&_data_start);
+  memset(&_bss_start, 0, (uintptr_t)&_bss_end - (uintptr_t)&_bss_start);
+  semihosting_exit(main());
+}
+
+static void fault_handler(void) {
+  semihosting_write("fault\n");
+  semihosting_exit(1);
+}
+
+__attribute__((section(".vectors"), used)) static void* const vectors[] = {
+    &_stack_top,    // Initial stack pointer.
+    reset_handler,  // Reset.
+    fault_handler,  // NMI.
+    fault_handler,  // HardFault.
+    fault_handler,  // MemManage.
+    fault_handler,  // BusFault.
+    fault_handler,  // UsageFault.
+};
+
+// ARM semihosting: operation in r0, argument in r1, "bkpt 0xab" traps into
+// the debugger (or QEMU with -semihosting-config enable=on).
+static int semihosting_call(int op, const void* arg) {
+  register int r0 __asm__("r0") = op;
+  register const void* r1 __asm__("r1") = arg;
+  __asm__ volatile("bkpt 0xab" : "+r"(r0) : "r"(r1) : "memory");
+  return r0;
+}
+
+void semihosting_write(const char* s) {
+  semihosting_call(0x04, s);  // SYS_WRITE0
+}
+
+void semihosting_exit(int status) {
+  // SYS_EXIT with ADP_Stopped_ApplicationExit. The 32-bit ABI can't pass
+  // the exit code, so failures are reported as ADP_Stopped_RunTimeErrorUnknown.
+  semihosting_call(0x18, (const void*)(status ? 0x20023 : 0x20026));
+  for (;;) {
+  }
+}
@@ -0,0 +1,11 @@
+// Flight recorder mode isn't supported with BUFFY_MULTI_PRODUCER, where the
+// TX path neither writes record headers nor counts records. The Makefile
+// checks that this only builds without it.
+
+#include "buffy.h"
+
+INSTANTIATE_BUFFY_FLIGHT_RECORDER(recorder);
+
+int recorder_size(void) {
+  return buffy_tx_get_buffer_size(&recorder);
+}
@@ -0,0 +1,108 @@
+#include "frame_decoder.h"
+
+#include <string>
+#include <vector>
+
+#include <cutest.h>
+
+#include "buffy.h"
+#include "test_util.h"
+
+using buffy_host::FrameDecoder;
+
+// Collects everything the decoder hands out.
+static void Collect(FrameDecoder* decoder, std::vector<std::string>* frames) {
+  decoder->SetFrameCallback([frames](const uint8_t* data, size_t len) {
+    frames->emplace_back(reinterpret_cast<const char*>(data), len);
+  });
+}
+
+// Odd read size, so frames get split between reads.
+constexpr size_t kReadSize = 37;
+
+static void Feed(FrameDecoder* decoder, const std::string& data) {
+  decoder->Feed(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+void test_encoding(void) {
+  INSTANTIATE_BUFFY_SIZED(channel, 1024, 8);
+  TEST_EQ(buffy_tx_frame(&channel, "", 0), 0);
+  TEST_CHECK(ReadAll(&channel, kReadSize) == std::string("\x01\x00", 2));
+  TEST_EQ(buffy_tx_frame(&channel, "\0", 1), 1);
+  TEST_CHECK(ReadAll(&channel, kReadSize) == std::string("\x01\x01\x00", 3));
+  TEST_EQ(buffy_tx_frame(&channel, "ab\0c", 4), 4);
+  TEST_CHECK(ReadAll(&channel, kReadSize) ==
+             std::string("\x03" "ab\x02" "c\x00", 6));
+
+  // A run of 254 non-zero bytes fills a block, the next one starts right
+  // away.
+  std::string run(254, 'x');
+  TEST_EQ(buffy_tx_frame(&channel, run.data(), run.size()), 254);
+  TEST_CHECK(ReadAll(&channel, kReadSize) ==
+             "\xff" + run + std::string("\x01\x00", 2));
+}
+
+void test_round_trip(void) {
+  INSTANTIATE_BUFFY_SIZED(channel, 1024, 8);
+  std::vector<std::string> sent = {
+      "hello", std::string("\0\0\0", 3), std::string(254, 'a'),
+      std::string(255, 'b'), std::string("x\0y", 3) + std::string(600, 'z'),
+      ""};
+  FrameDecoder decoder;
+  std::vector<std::string> frames;
+  Collect(&decoder, &frames);
+  for (const std::string& frame : sent) {
+    TEST_EQ(buffy_tx_frame(&channel, frame.data(), frame.size()),
+            static_cast<int>(frame.size()));
+    Feed(&decoder, ReadAll(&channel, kReadSize));
+  }
+  TEST_CHECK(frames == sent);
+  TEST_EQ(decoder.frames(), sent.size());
+  TEST_EQ(decoder.bad_frames(), 0u);
+}
+
+void test_resync(void) {
+  INSTANTIATE_BUFFY_SIZED(channel, 1024, 8);
+  FrameDecoder decoder;
+  std::vector<std::string> frames;
+  Collect(&decoder, &frames);
+  buffy_tx_frame(&channel, "first", 5);
+  buffy_tx_frame(&channel, "second", 6);
+  buffy_tx_frame(&channel, "third", 5);
+  std::string stream = ReadAll(&channel, kReadSize);
+
+  // Lose a few bytes from the middle of the second frame.
+  Feed(&decoder, stream.substr(0, 10));
+  decoder.Reset();
+  Feed(&decoder, stream.substr(12));
+  TEST_EQ(frames.size(), 2u);
+  TEST_CHECK(frames[0] == "first");
+  TEST_CHECK(frames[1] == "third");
+  TEST_EQ(decoder.bad_frames(), 0u);
+  TEST_EQ(decoder.skipped_bytes(), 6u);
+
+  // Attaching in the middle of the stream works the same way.
+  FrameDecoder late;
+  std::vector<std::string> late_frames;
+  Collect(&late, &late_frames);
+  late.Reset();
+  Feed(&late, stream.substr(3));
+  TEST_EQ(late_frames.size(), 2u);
+}
+
+void test_full(void) {
+  INSTANTIATE_BUFFY_SIZED(channel, 16, 8);
+  // 14 bytes of data make a 16 byte frame.
+  TEST_EQ(buffy_tx_frame(&channel, "0123456789abcd", 14), 14);
+  TEST_EQ(buffy_tx_frame(&channel, "", 0), 0);
+  TEST_EQ(channel.tx_dropped_records, 1u);
+  ReadAll(&channel, kReadSize);
+  TEST_EQ(buffy_tx_frame(&channel, "0123456789abcde", 15), 0);
+  TEST_EQ(channel.tx_head, 16u);
+}
+
+TEST_LIST = {{"test_encoding", test_encoding},
+             {"test_round_trip", test_round_trip},
+             {"test_resync", test_resync},
+             {"test_full", test_full},
+             {0}};
@@ -0,0 +1,149 @@
+#include "gdb_remote.h"
+
+#include <string.h>  // memcmp
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cutest.h>
+
+#include "buffy.h"
+#include "gdb_server.h"
+#include "reader.h"
+#include "simulated_target.h"
+#include "test_util.h"
+
+using buffy_host::GdbRemote;
+using buffy_host::GdbServer;
+using buffy_host::Reader;
+using buffy_host::SimulatedTarget;
+
+// Reader on GdbRemote on GdbServer, with buffy.c writing from another thread.
+void test_server(void) {
+  INSTANTIATE_BUFFY(channel);
+  SimulatedTarget target(&channel);
+  GdbServer server(&target);
+  TEST_CHECK(server.Start());
+  GdbRemote gdb;
+  TEST_CHECK(gdb.Connect("127.0.0.1", server.port()));
+  TEST_EQ(gdb.packet_size(), 0x4000u);
+  TEST_CHECK(gdb.non_stop());
+  Reader reader(&gdb, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  std::string received;
+  reader.SetDataCallback([&](const uint8_t* data, size_t len) {
+    received.append(reinterpret_cast<const char*>(data), len);
+  });
+
+  std::string sent;
+  for (int i = 0; i < 500; i++) sent += static_cast<char>('a' + i % 26);
+  std::thread producer([&]() {
+    size_t pos = 0;
+    while (pos < sent.size()) {
+      pos += buffy_tx(&channel, sent.data() + pos,
+                      std::min<size_t>(7, sent.size() - pos));
+    }
+  });
+  while (received.size() < sent.size()) {
+    if (!TEST_CHECK(reader.Poll() >= 0)) break;
+  }
+  producer.join();
+  TEST_CHECK(received == sent);
+  TEST_EQ(server.packets(), gdb.round_trips());
+
+  const uint8_t data[] = {'h', 'i'};
+  TEST_EQ(reader.Write(data, 2), 2);
+  char buf[4];
+  TEST_EQ(buffy_rx(&channel, buf, sizeof(buf)), 2);
+  TEST_CHECK(buf[0] == 'h' && buf[1] == 'i');
+
+  std::string reply;
+  TEST_CHECK(gdb.Command("vMustReplyEmpty", &reply));
+  TEST_CHECK(reply.empty());
+}
+
+void test_packet_size(void) {
+  uint8_t memory[200] = {};
+  SimulatedTarget target;
+  target.AddRegion(0x20000000, memory, sizeof(memory));
+  GdbServer::Options options;
+  options.packet_size = 64;
+  options.non_stop = false;
+  GdbServer server(&target, options);
+  TEST_CHECK(server.Start());
+  GdbRemote gdb;
+  TEST_CHECK(gdb.Connect("127.0.0.1", server.port()));
+  TEST_EQ(gdb.packet_size(), 64u);
+  TEST_CHECK(!gdb.non_stop());
+
+  // 100 bytes take 5 M packets of 22 bytes and 4 m packets of 32.
+  uint8_t data[100];
+  for (size_t i = 0; i < sizeof(data); i++) data[i] = i * 7;
+  uint64_t round_trips = gdb.round_trips();
+  TEST_CHECK(gdb.WriteMemory(0x20000010, data, sizeof(data)));
+  TEST_EQ(gdb.round_trips() - round_trips, 5u);
+  TEST_CHECK(memcmp(memory + 0x10, data, sizeof(data)) == 0);
+  uint8_t buf[100] = {};
+  round_trips = gdb.round_trips();
+  TEST_CHECK(gdb.ReadMemory(0x20000010, buf, sizeof(buf)));
+  TEST_EQ(gdb.round_trips() - round_trips, 4u);
+  TEST_CHECK(memcmp(buf, data, sizeof(data)) == 0);
+
+  TEST_CHECK(!gdb.ReadMemory(0x30000000, buf, 4));
+  TEST_CHECK(gdb.error() == "read failed: E01");
+}
+
+void test_framing(void) {
+  // No QStartNoAckMode, so acks stay on. The read reply comes with a bad
+  // checksum first, and after a stop notification again: "ab" and "0"
+  // repeated 5 more times ('"' is 29 + 5). Packets end in '#' and two
+  // checksum digits.
+  FakeServer server(
+      [](const std::string& pending) {
+        size_t end = pending.find('#');
+        return end != std::string::npos && pending.size() >= end + 3 ? end + 3
+                                                                     : 0;
+      },
+      {"+$PacketSize=100#c1", "+$#00",
+       "+$ab0*\"#00%Stop:T05#99$ab0*\"#3f"});
+  GdbRemote gdb;
+  TEST_CHECK(gdb.Connect("127.0.0.1", server.port()));
+  TEST_EQ(gdb.packet_size(), 0x100u);
+  TEST_CHECK(!gdb.non_stop());
+  uint8_t buf[4];
+  TEST_CHECK(gdb.ReadMemory(0x20000000, buf, 4));
+  TEST_EQ(buf[0], 0xab);
+  TEST_EQ(buf[1], 0);
+  TEST_EQ(buf[3], 0);
+  gdb.Close();
+}
+
+// Malformed run-length encoding in the read reply: nothing to repeat, counts
+// below 29 or above 126, and '#' or '$' as the count.
+void test_bad_run_length(void) {
+  for (std::string reply : {"*\"", "ab0*\x1c", "ab0*\x7f", "ab0*\xff",
+                            "ab0*$", "ab0*"}) {
+    FakeServer server(
+        [](const std::string& pending) {
+          size_t end = pending.find('#');
+          return end != std::string::npos && pending.size() >= end + 3
+                     ? end + 3
+                     : 0;
+        },
+        {"+$PacketSize=100#c1", "+$#00", "+$" + reply + "#00"});
+    GdbRemote gdb;
+    TEST_CHECK(gdb.Connect("127.0.0.1", server.port()));
+    uint8_t buf[4];
+    TEST_CHECK(!gdb.ReadMemory(0x20000000, buf, 4));
+    TEST_CHECK_(gdb.error() == "bad run-length encoding", "reply %s: %s",
+                reply.c_str(), gdb.error().c_str());
+  }
+}
+
+TEST_LIST = {{"test_server", test_server},
+             {"test_packet_size", test_packet_size},
+             {"test_framing", test_framing},
+             {"test_bad_run_length", test_bad_run_length},
+             {0}};
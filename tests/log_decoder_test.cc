@@ -0,0 +1,200 @@
+#include "log_decoder.h"
+
+#include <string.h>  // memcpy
+
+#include <string>
+#include <vector>
+
+#include <cutest.h>
+
+#include "buffy.h"
+#include "test_util.h"
+
+#define TEST_STR_EQ(a, b)                                               \
+  do {                                                                  \
+    std::string _a = (a);                                               \
+    std::string _b = (b);                                               \
+    TEST_CHECK_(_a == _b, "\"%s\" != \"%s\"", _a.c_str(), _b.c_str()); \
+  } while (0)
+
+// Provided by the linker, same as __start_buffy_fmt.
+extern "C" const char __stop_buffy_fmt[];
+
+// Contents of this binary's own format string section.
+static std::string FormatSection() {
+  return std::string(__start_buffy_fmt, __stop_buffy_fmt - __start_buffy_fmt);
+}
+
+static std::vector<std::string> Drain(struct buffy* t,
+                                      buffy_host::LogDecoder* decoder) {
+  std::vector<std::string> messages;
+  decoder->SetMessageCallback(
+      [&](int level, const std::string& message) {
+        messages.push_back(message);
+      });
+  char buf[64];
+  int len;
+  while ((len = buffy_tx_buffer_read(t, buf, sizeof(buf))) > 0) {
+    decoder->Feed(reinterpret_cast<uint8_t*>(buf), len);
+  }
+  return messages;
+}
+
+void test_format(void) {
+  buffy_host::LogDecoder decoder;
+  uint32_t args[] = {static_cast<uint32_t>(-5), 0xbeef, 'x', 7, 42};
+  TEST_STR_EQ(decoder.Format("a%d b%04x c%c d%*u%%", args, 5),
+              "a-5 bbeef cx d     42%");
+  TEST_STR_EQ(decoder.Format("%lu %hhx", args + 3, 2), "7 2a");
+  // Missing arguments are zeroes, strings are addresses without an ELF file.
+  TEST_STR_EQ(decoder.Format("%s %d", args + 1, 1), "<0x0000beef> 0");
+  TEST_EQ(buffy_host::LogDecoder::CountArgs("none %% here"), 0u);
+  TEST_EQ(buffy_host::LogDecoder::CountArgs("%d %.*s %-8x %"), 4u);
+}
+
+void test_buffy_log(void) {
+  INSTANTIATE_BUFFY(channel);
+  BUFFY_LOG(&channel, "boot");
+  BUFFY_LOG(&channel, "adc %d: %u mV", 3, 1650);
+  // Record is the ID plus one word per argument.
+  TEST_EQ(channel.tx_head, 4u + (4 + 2 * 4));
+
+  buffy_host::LogDecoder decoder;
+  decoder.SetFormats(FormatSection());
+  std::vector<std::string> messages = Drain(&channel, &decoder);
+  TEST_EQ(messages.size(), 2u);
+  TEST_STR_EQ(messages[0], "boot");
+  TEST_STR_EQ(messages[1], "adc 3: 1650 mV");
+
+  // Records are all or nothing.
+  channel.tx_tail = channel.tx_head - BUFFY_TX_BUF_SIZE + 8;
+  TEST_EQ(channel.tx_overflow_counter, 0u);
+  BUFFY_LOG(&channel, "%x %x", 1, 2);
+  TEST_EQ(channel.tx_overflow_counter, 1u);
+  channel.tx_tail = channel.tx_head;
+}
+
+void test_levels(void) {
+  INSTANTIATE_BUFFY(channel);
+  buffy_host::LogDecoder decoder;
+  decoder.SetFormats(FormatSection());
+  std::vector<int> levels;
+  std::vector<std::string> messages;
+  decoder.SetMessageCallback([&](int level, const std::string& message) {
+    levels.push_back(level);
+    messages.push_back(message);
+  });
+
+  // Filtered records don't even evaluate their arguments.
+  channel.tx_level = BUFFY_LEVEL_WARNING;
+  int evaluated = 0;
+  BUFFY_LOG_LEVEL(&channel, BUFFY_LEVEL_DEBUG, "n=%d", ++evaluated);
+  BUFFY_LOG(&channel, "n=%d", ++evaluated);
+  TEST_EQ(evaluated, 0);
+  TEST_EQ(channel.tx_head, 0u);
+  BUFFY_LOG_LEVEL(&channel, BUFFY_LEVEL_ERROR, "n=%d", ++evaluated);
+  TEST_EQ(evaluated, 1);
+
+  channel.tx_level = BUFFY_LEVEL_DEBUG;
+  BUFFY_LOG(&channel, "info");
+
+  char buf[64];
+  int len = buffy_tx_buffer_read(&channel, buf, sizeof(buf));
+  decoder.Feed(reinterpret_cast<uint8_t*>(buf), len);
+  TEST_EQ(messages.size(), 2u);
+  TEST_STR_EQ(messages[0], "n=1");
+  TEST_EQ(levels[0], BUFFY_LEVEL_ERROR);
+  TEST_STR_EQ(messages[1], "info");
+  TEST_EQ(levels[1], BUFFY_LEVEL_INFO);
+}
+
+void test_feed_partial(void) {
+  INSTANTIATE_BUFFY(channel);
+  buffy_host::LogDecoder decoder;
+  decoder.SetFormats(FormatSection());
+  std::vector<std::string> messages;
+  decoder.SetMessageCallback(
+      [&](int level, const std::string& message) {
+        messages.push_back(message);
+      });
+
+  BUFFY_LOG(&channel, "x=%d", 12);
+  uint8_t record[8];
+  TEST_EQ(buffy_tx_buffer_read(&channel, reinterpret_cast<char*>(record), 8),
+          8);
+
+  // Garbage is skipped, partial records wait for the rest.
+  uint8_t garbage[] = {0xff, 0xff, 0xff, 0xff, 0xff};
+  decoder.Feed(garbage, sizeof(garbage));
+  decoder.Feed(record, 5);
+  TEST_EQ(messages.size(), 0u);
+  decoder.Feed(record + 5, 3);
+  TEST_EQ(messages.size(), 1u);
+  TEST_STR_EQ(messages[0], "x=12");
+  TEST_EQ(decoder.skipped_bytes(), 5u);
+}
+
+// Builds an ELF image with a format string section and a .rodata section at
+// 0x08001000.
+static std::string BuildElf(const std::string& formats,
+                            const std::string& rodata) {
+  const std::string names("\0buffy_fmt\0.rodata\0.shstrtab\0", 29);
+  std::string data = formats + rodata + names;
+  std::string image(52, '\0');
+  memcpy(&image[0], "\x7f" "ELF\x01\x01\x01", 7);
+  uint32_t shoff = image.size() + data.size();
+  memcpy(&image[0x20], &shoff, 4);
+  uint16_t shentsize = 40, shnum = 4, shstrndx = 3;
+  memcpy(&image[0x2e], &shentsize, 2);
+  memcpy(&image[0x30], &shnum, 2);
+  memcpy(&image[0x32], &shstrndx, 2);
+  image += data;
+  auto add_section = [&](uint32_t name, uint32_t type, uint32_t flags,
+                         uint32_t addr, uint32_t offset, uint32_t size) {
+    uint32_t header[10] = {name, type, flags, addr, offset, size};
+    image.append(reinterpret_cast<char*>(header), sizeof(header));
+  };
+  add_section(0, 0, 0, 0, 0, 0);
+  add_section(1, 1, 0, 0, 52, formats.size());
+  add_section(11, 1, 2, 0x08001000, 52 + formats.size(), rodata.size());
+  add_section(19, 3, 0, 0, 52 + formats.size() + rodata.size(), names.size());
+  return image;
+}
+
+void test_elf(void) {
+  std::string formats("\0%s says %d\0", 12);
+  std::string rodata("xxsensor\0", 9);
+  buffy_host::ElfFile elf;
+  TEST_CHECK(!elf.Parse("nope"));
+  TEST_CHECK(elf.Parse(BuildElf(formats, rodata)));
+  TEST_STR_EQ(elf.FindSection("buffy_fmt")->data, formats);
+  std::string str;
+  TEST_CHECK(elf.ReadString(0x08001002, &str));
+  TEST_STR_EQ(str, "sensor");
+  TEST_CHECK(!elf.ReadString(0x08002000, &str));
+
+  const char* path = "log_decoder_test.elf";
+  FILE* f = fopen(path, "wb");
+  std::string image = BuildElf(formats, rodata);
+  fwrite(image.data(), 1, image.size(), f);
+  fclose(f);
+  buffy_host::LogDecoder decoder;
+  TEST_CHECK(decoder.LoadElf(path));
+  remove(path);
+  std::vector<std::string> messages;
+  decoder.SetMessageCallback(
+      [&](int level, const std::string& message) {
+        messages.push_back(message);
+      });
+  uint8_t record[] = {1, 0, 0, 0, 0x02, 0x10, 0x00, 0x08, 9, 0, 0, 0};
+  decoder.Feed(record, sizeof(record));
+  TEST_EQ(messages.size(), 1u);
+  TEST_STR_EQ(messages[0], "sensor says 9");
+}
+
+TEST_LIST = {{"test_format", test_format},
+             {"test_buffy_log", test_buffy_log},
+             {"test_levels", test_levels},
+             {"test_feed_partial", test_feed_partial},
+             {"test_elf", test_elf},
+             {0}};
@@ -0,0 +1,157 @@
+#include "openocd_tcl.h"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cutest.h>
+
+#include "buffy.h"
+#include "reader.h"
+#include "simulated_target.h"
+#include "tcl_server.h"
+#include "test_util.h"
+
+using buffy_host::OpenOcdTcl;
+using buffy_host::Reader;
+using buffy_host::SimulatedTarget;
+using buffy_host::TclServer;
+
+// Answers each command with the next canned reply, with OpenOCD's framing:
+// commands and replies end in 0x1a.
+class FakeTclServer : public FakeServer {
+ public:
+  explicit FakeTclServer(std::vector<std::string> replies)
+      : FakeServer(
+            [](const std::string& pending) {
+              size_t end = pending.find('\x1a');
+              return end == std::string::npos ? 0 : end + 1;
+            },
+            Terminate(std::move(replies))) {}
+
+ private:
+  static std::vector<std::string> Terminate(std::vector<std::string> replies) {
+    for (std::string& reply : replies) reply += '\x1a';
+    return replies;
+  }
+};
+
+void test_memory(void) {
+  FakeTclServer server({"", "0x01 0x02 0xff 0x04", "", "invalid command name"});
+  {
+    OpenOcdTcl tcl;
+    TEST_CHECK(tcl.Connect("127.0.0.1", server.port()));
+    uint8_t buf[4];
+    TEST_CHECK(tcl.ReadMemory(0x20000000, buf, 4));
+    TEST_EQ(buf[2], 0xff);
+    const uint8_t data[] = {'a', 'b'};
+    TEST_CHECK(tcl.WriteMemory(0x20000010, data, 2));
+    TEST_CHECK(!tcl.WriteMemory(0x20000010, data, 2));
+    TEST_CHECK(tcl.error() == "invalid command name");
+    TEST_EQ(tcl.round_trips(), 4u);
+  }
+  const std::vector<std::string>& commands = server.requests();
+  if (!TEST_CHECK(commands.size() == 4)) return;
+  TEST_CHECK(commands[0] == std::string(OpenOcdTcl::kPollProc) + '\x1a');
+  TEST_CHECK(commands[1] == "read_memory 0x20000000 8 4\x1a");
+  TEST_CHECK(commands[2] == "write_memory 0x20000010 8 {0x61 0x62}\x1a");
+}
+
+void test_drain(void) {
+  // Header words, 16 byte TX buffer with tail 14 and head 18, then the data.
+  FakeTclServer server({"",
+                     "0xdd664642 0x30403 0xe 0x12 0x0 0x0 0x0 0x20001000 "
+                     "0x20002000 0x77 0x72 0x61 0x70"});
+  OpenOcdTcl tcl;
+  TEST_CHECK(tcl.Connect("127.0.0.1", server.port()));
+  TEST_CHECK(tcl.SupportsDrainTx());
+  buffy_host::BuffyHeader header;
+  std::vector<uint8_t> data;
+  TEST_CHECK(tcl.DrainTx(0x20000000, &header, &data));
+  TEST_EQ(header.magic, buffy_host::kBuffyMagic);
+  TEST_EQ(header.version, 3);
+  TEST_EQ(header.tx_size(), 16u);
+  TEST_EQ(header.tx_tail, 14u);
+  TEST_EQ(header.tx_head, 18u);
+  TEST_EQ(header.tx_buf, 0x20001000u);
+  TEST_CHECK(std::string(data.begin(), data.end()) == "wrap");
+  TEST_EQ(tcl.round_trips(), 2u);
+  tcl.Close();
+}
+
+void test_no_poll_proc(void) {
+  // Installing buffy_poll fails, reads and writes still go through.
+  FakeTclServer server({"invalid command name \"proc\"", "0x01 0x02"});
+  OpenOcdTcl tcl;
+  TEST_CHECK(tcl.Connect("127.0.0.1", server.port()));
+  TEST_CHECK(!tcl.SupportsDrainTx());
+  uint8_t buf[2];
+  TEST_CHECK(tcl.ReadMemory(0x20000000, buf, 2));
+  TEST_EQ(buf[1], 0x02);
+  tcl.Close();
+}
+
+// Reader on OpenOcdTcl on TclServer, with buffy.c writing from another thread.
+void check_server(bool drain_tx) {
+  INSTANTIATE_BUFFY(channel);
+  SimulatedTarget target(&channel);
+  TclServer server(&target);
+  TEST_CHECK(server.Start());
+  OpenOcdTcl tcl;
+  TEST_CHECK(tcl.Connect("127.0.0.1", server.port()));
+  tcl.set_drain_tx(drain_tx);
+  Reader reader(&tcl, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  std::string received;
+  reader.SetDataCallback([&](const uint8_t* data, size_t len) {
+    received.append(reinterpret_cast<const char*>(data), len);
+  });
+
+  std::string sent;
+  for (int i = 0; i < 500; i++) sent += static_cast<char>('a' + i % 26);
+  std::thread producer([&]() {
+    size_t pos = 0;
+    while (pos < sent.size()) {
+      pos += buffy_tx(&channel, sent.data() + pos,
+                      std::min<size_t>(7, sent.size() - pos));
+    }
+  });
+  while (received.size() < sent.size()) {
+    if (!TEST_CHECK(reader.Poll() >= 0)) break;
+  }
+  producer.join();
+  TEST_CHECK(received == sent);
+  // Without batching, each tail write comes with at least a header read and a
+  // data read.
+  if (drain_tx) {
+    TEST_EQ(server.commands(), tcl.round_trips());
+  } else {
+    TEST_CHECK(tcl.round_trips() >= 1 + 3 * target.write_requests());
+  }
+
+  const uint8_t data[] = {'h', 'i'};
+  TEST_EQ(reader.Write(data, 2), 2);
+  char buf[4];
+  TEST_EQ(buffy_rx(&channel, buf, sizeof(buf)), 2);
+  TEST_CHECK(buf[0] == 'h' && buf[1] == 'i');
+
+  std::string result;
+  TEST_CHECK(tcl.Command("halt", &result));
+  TEST_CHECK(result == "invalid command name \"halt\"");
+}
+
+void test_server(void) {
+  check_server(true);
+}
+
+void test_server_separate(void) {
+  check_server(false);
+}
+
+TEST_LIST = {{"test_memory", test_memory},
+             {"test_drain", test_drain},
+             {"test_no_poll_proc", test_no_poll_proc},
+             {"test_server", test_server},
+             {"test_server_separate", test_server_separate},
+             {0}};
@@ -0,0 +1,95 @@
+#include "poll_scheduler.h"
+
+#include <string>
+#include <thread>
+
+#include <cutest.h>
+
+#include "buffy.h"
+#include "simulated_target.h"
+#include "test_util.h"
+
+using buffy_host::PollScheduler;
+using std::chrono::microseconds;
+
+void test_idle_backoff(void) {
+  PollScheduler scheduler(1024);
+  PollScheduler::Clock::time_point now;
+  TEST_EQ(scheduler.Update(now, 0, 0).count(), 100);
+  int64_t expected = 100;
+  for (int i = 0; i < 20; i++) {
+    now += scheduler.stats().interval;
+    expected = std::min<int64_t>(expected * 2, 100000);
+    TEST_EQ(scheduler.Update(now, 0, 0).count(), expected);
+  }
+  TEST_EQ(scheduler.stats().interval.count(), 100000);
+  TEST_EQ(scheduler.stats().polls, 21u);
+}
+
+void test_steady_rate(void) {
+  // 10 kB/s into a 1 kB buffer: polling every 51.2 ms leaves it half full.
+  PollScheduler scheduler(1024);
+  PollScheduler::Clock::time_point now;
+  scheduler.Update(now, 0, 0);
+  for (int i = 0; i < 50; i++) {
+    microseconds interval = scheduler.stats().interval;
+    now += interval;
+    scheduler.Update(now, interval.count() / 100, 0);
+  }
+  TEST_CHECK(scheduler.stats().fill_rate > 9900);
+  TEST_CHECK(scheduler.stats().fill_rate < 10100);
+  TEST_CHECK(scheduler.stats().interval.count() > 50000);
+  TEST_CHECK(scheduler.stats().interval.count() < 52500);
+  TEST_CHECK(scheduler.stats().throughput > 9000);
+}
+
+void test_burst_and_overflow(void) {
+  PollScheduler scheduler(1024);
+  PollScheduler::Clock::time_point now;
+  scheduler.Update(now, 0, 0);
+  now += microseconds(100000);
+  scheduler.Update(now, 0, 0);
+  // A burst fills most of the buffer, poll again much sooner.
+  now += microseconds(100000);
+  microseconds interval = scheduler.Update(now, 1000, 0);
+  TEST_CHECK(interval.count() < 60000);
+  // Overflows mean we were too slow, go as fast as possible.
+  now += interval;
+  TEST_EQ(scheduler.Update(now, 1024, 3).count(), 100);
+  TEST_EQ(scheduler.stats().overflows, 3u);
+}
+
+void test_poll_loop(void) {
+  // Note, the define in Makefile sets TX buffer to 16B.
+  INSTANTIATE_BUFFY(channel);
+  buffy_host::SimulatedTarget target(&channel);
+  buffy_host::Reader reader(&target, buffy_host::SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  size_t received = 0;
+  reader.SetDataCallback(
+      [&](const uint8_t* data, size_t len) { received += len; });
+
+  PollScheduler::Options options;
+  options.min_interval = microseconds(10);
+  options.max_interval = microseconds(1000);
+  PollScheduler scheduler(reader.header().tx_size(), options);
+  const size_t total = 500;
+  std::thread producer([&]() {
+    for (size_t sent = 0; sent < total;) {
+      sent += buffy_tx(&channel, "0123456789",
+                       std::min<size_t>(10, total - sent));
+    }
+  });
+  TEST_CHECK(RunPollLoop(&reader, &scheduler,
+                         [&]() { return received >= total; }));
+  producer.join();
+  TEST_EQ(received, total);
+  TEST_EQ(scheduler.stats().bytes, total);
+  TEST_CHECK(scheduler.stats().throughput > 0);
+}
+
+TEST_LIST = {{"test_idle_backoff", test_idle_backoff},
+             {"test_steady_rate", test_steady_rate},
+             {"test_burst_and_overflow", test_burst_and_overflow},
+             {"test_poll_loop", test_poll_loop},
+             {0}};
@@ -0,0 +1,324 @@
+#include "reader.h"
+
+#include <string.h>  // memcmp
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cutest.h>
+
+#include "buffy.h"
+#include "simulated_target.h"
+#include "test_util.h"
+
+using buffy_host::Reader;
+using buffy_host::SimulatedTarget;
+
+// Collects everything the reader hands out.
+static void Collect(Reader* reader, std::vector<std::string>* chunks) {
+  reader->SetDataCallback([chunks](const uint8_t* data, size_t len) {
+    chunks->emplace_back(reinterpret_cast<const char*>(data), len);
+  });
+}
+
+void test_poll(void) {
+  // Note, the define in Makefile sets TX buffer to 16B.
+  INSTANTIATE_BUFFY(channel);
+  SimulatedTarget target(&channel);
+  Reader reader(&target, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  TEST_EQ(reader.header().version, BUFFY_VERSION);
+  TEST_EQ(reader.header().tx_size(), 16u);
+  std::vector<std::string> chunks;
+  Collect(&reader, &chunks);
+
+  TEST_EQ(reader.Poll(), 0);
+  TEST_EQ(buffy_tx(&channel, "hello", 5), 5);
+  uint64_t reads = target.read_requests();
+  TEST_EQ(reader.Poll(), 5);
+  // Header and one bulk read for the data.
+  TEST_EQ(target.read_requests() - reads, 2u);
+  TEST_EQ(chunks.size(), 1u);
+  TEST_CHECK(chunks[0] == "hello");
+  TEST_EQ(channel.tx_tail, 5u);
+
+  // Wrapped data takes one read per segment.
+  TEST_EQ(buffy_tx(&channel, "0123456789abcdef", 16), 16);
+  reads = target.read_requests();
+  TEST_EQ(reader.Poll(), 16);
+  TEST_EQ(target.read_requests() - reads, 3u);
+  TEST_CHECK(chunks[1] == "0123456789abcdef");
+  TEST_EQ(buffy_tx_get_buffer_free(&channel), 16);
+  TEST_EQ(reader.bytes_read(), 21u);
+}
+
+void test_drain(void) {
+  INSTANTIATE_BUFFY(channel);
+  SimulatedTarget target(&channel);
+  target.set_drain_tx(true);
+  Reader reader(&target, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  std::vector<std::string> chunks;
+  Collect(&reader, &chunks);
+
+  uint64_t reads = target.read_requests();
+  TEST_EQ(reader.Poll(), 0);
+  TEST_EQ(buffy_tx(&channel, "hello", 5), 5);
+  TEST_EQ(reader.Poll(), 5);
+  TEST_EQ(buffy_tx(&channel, "0123456789abcdef", 16), 16);
+  TEST_EQ(reader.Poll(), 16);
+  // One request per poll, wrapped or not, and nothing else.
+  TEST_EQ(target.read_requests() - reads, 3u);
+  TEST_EQ(target.write_requests(), 0u);
+  if (!TEST_CHECK(chunks.size() == 2)) return;
+  TEST_CHECK(chunks[0] == "hello");
+  TEST_CHECK(chunks[1] == "0123456789abcdef");
+  TEST_EQ(channel.tx_tail, 21u);
+  TEST_EQ(reader.header().tx_tail, 21u);
+}
+
+void test_write(void) {
+  INSTANTIATE_BUFFY(channel);
+  SimulatedTarget target(&channel);
+  Reader reader(&target, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+
+  // Note, the define in Makefile sets RX buffer to 8B.
+  TEST_EQ(reader.Write(reinterpret_cast<const uint8_t*>("abcdefghij"), 10), 8);
+  TEST_EQ(reader.Write(reinterpret_cast<const uint8_t*>("x"), 1), 0);
+  char buf[8];
+  TEST_EQ(buffy_rx(&channel, buf, 5), 5);
+  TEST_EQ(reader.Write(reinterpret_cast<const uint8_t*>("klm"), 3), 3);
+  TEST_EQ(buffy_rx(&channel, buf, 8), 6);
+  TEST_EQ(memcmp(buf, "fghklm", 6), 0);
+}
+
+void test_send_command(void) {
+  INSTANTIATE_BUFFY(channel);
+  SimulatedTarget target(&channel);
+  Reader reader(&target, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  static std::string received;
+  received.clear();
+  const struct buffy_command commands[] = {
+      {5, [](struct buffy*, const uint8_t* data, int len) {
+         received.assign(reinterpret_cast<const char*>(data), len);
+       }}};
+
+  TEST_EQ(reader.SendCommand(5, reinterpret_cast<const uint8_t*>("go"), 2), 1);
+  // All or nothing: RX buffer is 8B, 6 of them are taken.
+  TEST_EQ(reader.SendCommand(5, reinterpret_cast<const uint8_t*>("x"), 1), 0);
+  TEST_EQ(buffy_rx_poll(&channel, commands, 1), 1);
+  TEST_CHECK(received == "go");
+  TEST_EQ(reader.SendCommand(5, reinterpret_cast<const uint8_t*>("x"), 1), 1);
+  TEST_EQ(buffy_rx_poll(&channel, commands, 1), 1);
+  TEST_CHECK(received == "x");
+
+  TEST_EQ(reader.SendCommand(5, reinterpret_cast<const uint8_t*>("12345"), 5),
+          -1);
+}
+
+void test_overwrite(void) {
+  INSTANTIATE_BUFFY_FLIGHT_RECORDER(channel);
+  SimulatedTarget target(&channel);
+  Reader reader(&target, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  std::vector<std::string> records;
+  Collect(&reader, &records);
+
+  buffy_tx(&channel, "one", 3);
+  buffy_tx(&channel, "two", 3);
+  TEST_EQ(reader.Poll(), 10);
+  TEST_EQ(records.size(), 2u);
+  TEST_CHECK(records[1] == "two");
+  // The host doesn't touch the tail in flight recorder mode.
+  TEST_EQ(channel.tx_tail, 0u);
+
+  // Overwrite "one" and "two" while the host isn't looking.
+  buffy_tx(&channel, "three", 5);
+  buffy_tx(&channel, "four!", 5);
+  TEST_EQ(channel.tx_tail, 10u);
+  TEST_EQ(reader.Poll(), 14);
+  TEST_EQ(records.size(), 4u);
+  TEST_CHECK(records[2] == "three");
+  TEST_CHECK(records[3] == "four!");
+  TEST_EQ(reader.lost_bytes(), 0u);
+
+  // Now lose "fivefive" and "six" before they're read.
+  buffy_tx(&channel, "fivefive", 8);
+  buffy_tx(&channel, "six", 3);
+  buffy_tx(&channel, "seven77", 7);
+  buffy_tx(&channel, "eight", 5);
+  TEST_EQ(reader.Poll(), 16);
+  TEST_EQ(records.size(), 6u);
+  TEST_CHECK(records[4] == "seven77");
+  TEST_CHECK(records[5] == "eight");
+  TEST_EQ(reader.lost_bytes(), 10u + 5);
+  TEST_EQ(reader.lost_records(), 2u);
+}
+
+void test_overwrite_attach(void) {
+  INSTANTIATE_BUFFY_FLIGHT_RECORDER(channel);
+  SimulatedTarget target(&channel);
+  // "one" is gone before the host attaches, that's not counted as lost.
+  buffy_tx(&channel, "one", 3);
+  buffy_tx(&channel, "twotwo", 6);
+  buffy_tx(&channel, "three", 5);
+  TEST_EQ(channel.tx_records, 3u);
+  Reader reader(&target, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  TEST_EQ(reader.header().tx_records, 3u);
+  std::vector<std::string> records;
+  Collect(&reader, &records);
+
+  TEST_EQ(reader.Poll(), 15);
+  TEST_EQ(records.size(), 2u);
+  TEST_EQ(reader.lost_records(), 0u);
+
+  // A record that's overwritten as soon as it's written.
+  buffy_tx(&channel, "fourfour", 8);
+  buffy_tx(&channel, "five", 4);
+  buffy_tx(&channel, "six", 3);
+  TEST_EQ(reader.Poll(), 11);
+  TEST_EQ(records.size(), 4u);
+  TEST_CHECK(records[2] == "five");
+  TEST_EQ(reader.lost_records(), 1u);
+}
+
+void test_overwrite_reset(void) {
+  INSTANTIATE_BUFFY_FLIGHT_RECORDER(channel);
+  SimulatedTarget target(&channel);
+  Reader reader(&target, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  std::vector<std::string> records;
+  Collect(&reader, &records);
+  buffy_tx(&channel, "one", 3);
+  buffy_tx(&channel, "two", 3);
+  TEST_EQ(reader.Poll(), 10);
+
+  // The target starts over behind our read position: nothing is lost, the
+  // reader picks up from the tail again.
+  channel.tx_tail = 0;
+  channel.tx_head = 0;
+  buffy_tx(&channel, "three", 5);
+  TEST_EQ(reader.Poll(), -1);
+  TEST_CHECK(reader.error() == "TX read position out of bounds");
+  TEST_EQ(reader.lost_bytes(), 0u);
+  TEST_EQ(reader.Poll(), 7);
+  TEST_EQ(records.size(), 3u);
+  TEST_CHECK(records[2] == "three");
+  TEST_EQ(reader.lost_bytes(), 0u);
+}
+
+void test_version1(void) {
+  // Version 1 structure with wrapped indexes: 8 bytes of data starting at
+  // index 12 of a 16 byte buffer. Byte 7 is 'initialized', not flags.
+  uint8_t tx_buf[16];
+  memcpy(tx_buf, "efghXXXXXXXXabcd", 16);
+  uint8_t image[36] = {0x42, 0x46, 0x66, 0xdd, 1, 4, 3, 1};
+  uint32_t words[] = {12, 4, 0, 0, 0, 0x20001000, 0x20002000};
+  memcpy(image + 8, words, sizeof(words));
+  SimulatedTarget target;
+  target.AddRegion(0x20000000, image, sizeof(image));
+  target.AddRegion(0x20001000, tx_buf, sizeof(tx_buf));
+
+  Reader reader(&target, 0x20000000);
+  TEST_CHECK(reader.Attach());
+  std::vector<std::string> chunks;
+  Collect(&reader, &chunks);
+  TEST_EQ(reader.Poll(), 8);
+  if (!TEST_CHECK(chunks.size() == 1)) return;
+  TEST_CHECK(chunks[0] == "abcdefgh");
+  uint32_t tail;
+  memcpy(&tail, image + 8, sizeof(tail));
+  TEST_EQ(tail, 4u);
+}
+
+void test_set_level(void) {
+  INSTANTIATE_BUFFY(channel);
+  SimulatedTarget target(&channel);
+  Reader reader(&target, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  TEST_CHECK(reader.SetLevel(BUFFY_LEVEL_WARNING));
+  TEST_EQ(channel.tx_level, static_cast<uint32_t>(BUFFY_LEVEL_WARNING));
+  TEST_CHECK(!BUFFY_LEVEL_ENABLED(&channel, BUFFY_LEVEL_INFO));
+  TEST_CHECK(BUFFY_LEVEL_ENABLED(&channel, BUFFY_LEVEL_ERROR));
+}
+
+void test_channels(void) {
+  INSTANTIATE_BUFFY(radio);
+  INSTANTIATE_BUFFY(power);
+  SimulatedTarget target;
+  target.AddBuffy(0x20000000, &radio);
+  target.AddBuffy(0x21000000, &power);
+  // Target layout of a root descriptor.
+  uint8_t root[8 + 2 * 16] = {0x52, 0x46, 0x66, 0xdd, 1, 2};
+  memcpy(root + 8, "radio", 5);
+  uint32_t addr = 0x20000000;
+  memcpy(root + 8 + 12, &addr, 4);
+  memcpy(root + 24, "power", 5);
+  addr = 0x21000000;
+  memcpy(root + 24 + 12, &addr, 4);
+  uint8_t ram[256] = {};
+  memcpy(ram + 128, root, sizeof(root));
+  target.AddRegion(0x30000000, ram, sizeof(ram));
+
+  uint32_t root_addr;
+  TEST_CHECK(buffy_host::FindMagic(&target, 0x30000000, sizeof(ram),
+                                   buffy_host::kBuffyRootMagic, &root_addr,
+                                   64));
+  TEST_EQ(root_addr, 0x30000080u);
+  std::vector<buffy_host::Channel> channels;
+  TEST_CHECK(buffy_host::ReadChannels(&target, root_addr, &channels));
+  if (!TEST_CHECK(channels.size() == 2)) return;
+  TEST_CHECK(channels[0].name == "radio");
+  TEST_CHECK(channels[1].name == "power");
+
+  Reader reader(&target, channels[1].addr);
+  TEST_CHECK(reader.Attach());
+  std::vector<std::string> chunks;
+  Collect(&reader, &chunks);
+  buffy_tx(&power, "pwr", 3);
+  TEST_EQ(reader.Poll(), 3);
+  TEST_CHECK(chunks[0] == "pwr");
+}
+
+void test_concurrent(void) {
+  INSTANTIATE_BUFFY(channel);
+  SimulatedTarget target(&channel);
+  Reader reader(&target, SimulatedTarget::kBuffyAddr);
+  TEST_CHECK(reader.Attach());
+  std::string received;
+  reader.SetDataCallback([&](const uint8_t* data, size_t len) {
+    received.append(reinterpret_cast<const char*>(data), len);
+  });
+
+  std::string sent;
+  for (int i = 0; i < 2000; i++) sent += static_cast<char>('a' + i % 26);
+  std::thread producer([&]() {
+    size_t pos = 0;
+    while (pos < sent.size()) {
+      pos += buffy_tx(&channel, sent.data() + pos,
+                      std::min<size_t>(7, sent.size() - pos));
+    }
+  });
+  while (received.size() < sent.size()) {
+    if (reader.Poll() < 0) break;
+  }
+  producer.join();
+  TEST_CHECK(received == sent);
+}
+
+TEST_LIST = {{"test_poll", test_poll},
+             {"test_drain", test_drain},
+             {"test_write", test_write},
+             {"test_send_command", test_send_command},
+             {"test_overwrite", test_overwrite},
+             {"test_overwrite_attach", test_overwrite_attach},
+             {"test_overwrite_reset", test_overwrite_reset},
+             {"test_version1", test_version1},
+             {"test_set_level", test_set_level},
+             {"test_channels", test_channels},
+             {"test_concurrent", test_concurrent},
+             {0}};
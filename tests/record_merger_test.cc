@@ -0,0 +1,151 @@
+#include "record_merger.h"
+
+#include <string.h>  // strcmp
+
+#include <string>
+#include <vector>
+
+#include <cutest.h>
+
+#include "buffy.h"
+#include "test_util.h"
+
+using buffy_host::RecordMerger;
+
+// Note, the define in Makefile sets TX buffers to 16B.
+INSTANTIATE_BUFFY_PERCPU(cores, 2);
+
+struct Received {
+  size_t stream;
+  uint64_t ticks;
+  std::string data;
+};
+
+// Collects everything the merger hands out.
+static void Collect(RecordMerger* merger, std::vector<Received>* out) {
+  merger->SetRecordCallback([out](const RecordMerger::Record& record) {
+    out->push_back({record.stream, record.ticks,
+                    std::string(reinterpret_cast<const char*>(record.data),
+                                record.len)});
+  });
+}
+
+// Reads everything out of a core's ring into the merger.
+static void Poll(RecordMerger* merger, size_t cpu, double host_time) {
+  char buf[16];
+  int n = buffy_tx_buffer_read(&cores[cpu], buf, sizeof(buf));
+  merger->Feed(cpu, reinterpret_cast<const uint8_t*>(buf), n, host_time);
+}
+
+static void Write(size_t cpu, uint32_t ticks, const char* data) {
+  fake_ticks = ticks;
+  TEST_EQ(buffy_tx_timestamped(&cores[cpu], data, strlen(data)),
+          static_cast<int>(strlen(data)));
+}
+
+void test_percpu(void) {
+  TEST_EQ(cores_root.channel_count, 2);
+  TEST_EQ(strcmp(cores_root.channels[0].name, "cpu0"), 0);
+  TEST_CHECK(cores_root.channels[0].buffy == &cores[0]);
+  TEST_EQ(strcmp(cores_root.channels[1].name, "cpu1"), 0);
+  TEST_CHECK(cores_root.channels[1].buffy == &cores[1]);
+  // Each core has its own buffers.
+  TEST_CHECK(cores[0].tx_buf != cores[1].tx_buf);
+  TEST_CHECK(cores[0].rx_buf != cores[1].rx_buf);
+  TEST_EQ(buffy_tx_get_buffer_size(&cores[1]), 16);
+}
+
+void test_merge(void) {
+  buffy_set_tick_hook(&cores[0], FakeTick);
+  buffy_set_tick_hook(&cores[1], FakeTick);
+  RecordMerger merger(2);
+  std::vector<Received> received;
+  Collect(&merger, &received);
+
+  Write(0, 10, "a");
+  Write(1, 12, "b");
+  Write(1, 14, "c");
+  Write(0, 20, "d");
+
+  // Core 1 might still have something older than core 0's records.
+  Poll(&merger, 0, 1.0);
+  TEST_EQ(received.size(), 0u);
+  TEST_EQ(merger.held(), 2u);
+  // Now everything up to core 1's newest record is known.
+  Poll(&merger, 1, 1.0);
+  if (!TEST_CHECK(received.size() == 3)) return;
+  TEST_CHECK(received[0].data == "a");
+  TEST_EQ(received[0].stream, 0u);
+  TEST_EQ(received[0].ticks, 10u);
+  TEST_CHECK(received[1].data == "b");
+  TEST_EQ(received[1].stream, 1u);
+  TEST_CHECK(received[2].data == "c");
+  TEST_EQ(merger.held(), 1u);
+
+  // Ties keep the order they were read in.
+  Write(1, 20, "e");
+  Poll(&merger, 1, 2.0);
+  if (!TEST_CHECK(received.size() == 5)) return;
+  TEST_CHECK(received[3].data == "d");
+  TEST_CHECK(received[4].data == "e");
+
+  Write(0, 30, "f");
+  Poll(&merger, 0, 3.0);
+  TEST_EQ(received.size(), 5u);
+  merger.Flush();
+  if (!TEST_CHECK(received.size() == 6)) return;
+  TEST_CHECK(received[5].data == "f");
+  TEST_EQ(merger.held(), 0u);
+}
+
+void test_quiet_over_wrap(void) {
+  buffy_set_tick_hook(&cores[0], FakeTick);
+  buffy_set_tick_hook(&cores[1], FakeTick);
+  RecordMerger merger(2);
+  std::vector<Received> received;
+  Collect(&merger, &received);
+
+  Write(0, 10, "a");
+  Write(1, 10, "b");
+  Poll(&merger, 0, 1.0);
+  Poll(&merger, 1, 1.0);
+  // Core 0 keeps going past a wrap of the 32-bit tick, core 1 is quiet.
+  for (uint32_t ticks : {0x80000000u, 0xfff00000u, 0x100u}) {
+    Write(0, ticks, "c");
+    Poll(&merger, 0, 2.0);
+  }
+  // Core 1's delta only says 0x1f6 ticks went by, but it can't be older than
+  // what core 0 has already sent.
+  Write(1, 0x200, "d");
+  Poll(&merger, 1, 3.0);
+  merger.Flush();
+  if (!TEST_CHECK(received.size() == 6)) return;
+  TEST_EQ(received[4].ticks, 0x100000100u);
+  TEST_CHECK(received[5].data == "d");
+  TEST_EQ(received[5].ticks, 0x100000200u);
+}
+
+void test_invalid_time(void) {
+  buffy_set_tick_hook(&cores[0], FakeTick);
+  buffy_set_tick_hook(&cores[1], FakeTick);
+  RecordMerger merger(2);
+  std::vector<Received> received;
+  Collect(&merger, &received);
+
+  // Lost the absolute time of core 0: its records are passed on as is.
+  Write(0, 10, "a");
+  Write(0, 11, "b");
+  char buf[16];
+  int n = buffy_tx_buffer_read(&cores[0], buf, sizeof(buf));
+  // Drop the first record (sync, 1 + 1 + 1 bytes).
+  merger.Feed(0, reinterpret_cast<const uint8_t*>(buf) + 3, n - 3, 1.0);
+  if (!TEST_CHECK(received.size() == 1)) return;
+  TEST_CHECK(received[0].data == "b");
+  TEST_EQ(merger.held(), 0u);
+}
+
+TEST_LIST = {{"test_percpu", test_percpu},
+             {"test_merge", test_merge},
+             {"test_quiet_over_wrap", test_quiet_over_wrap},
+             {"test_invalid_time", test_invalid_time},
+             {0}};
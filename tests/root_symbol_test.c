@@ -0,0 +1,12 @@
+// Instantiates a root descriptor at file scope without referencing it, like
+// firmware does: only the debugger reads it. Built with optimizations, the
+// Makefile checks that it neither warns nor gets dropped.
+
+#include "buffy.h"
+
+INSTANTIATE_BUFFY_SIZED(radio, 64, 4);
+INSTANTIATE_BUFFY(power);
+INSTANTIATE_BUFFY_ROOT(buffy_root, BUFFY_CHANNEL(radio), BUFFY_CHANNEL(power));
+INSTANTIATE_BUFFY_ROOT_IN_SECTION(section_root, ".data.buffy",
+                                  BUFFY_CHANNEL(radio));
+INSTANTIATE_BUFFY_PERCPU(cores, 2);
@@ -0,0 +1,103 @@
+// Stress tests: one thread writes an incrementing byte sequence while another
+// reads it out and checks that no byte arrives before its data does. This is
+// what the acquire/release ordering of heads and tails is for. Built without
+// the debug output, which would otherwise dominate.
+//
+// Only a weakly ordered host (ARM, not x86) can catch a missing barrier, see
+// the Makefile.
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cutest.h>
+
+#include "buffy.h"
+#include "test_util.h"
+
+#define STRESS_BYTES 1000000
+
+static void* stress_tx_producer(void* arg) {
+  struct buffy* t = arg;
+  uint8_t next = 0;
+  char chunk[7];
+  for (int sent = 0; sent < STRESS_BYTES;) {
+    int len = 1 + sent % sizeof(chunk);
+    if (len > STRESS_BYTES - sent) len = STRESS_BYTES - sent;
+    for (int i = 0; i < len; i++) chunk[i] = next + i;
+    int n = buffy_tx(t, chunk, len);
+    if (n == 0) sched_yield();
+    next += n;
+    sent += n;
+  }
+  return NULL;
+}
+
+void test_tx_stress(void) {
+  INSTANTIATE_BUFFY(buffy);
+  pthread_t producer;
+  pthread_create(&producer, NULL, stress_tx_producer, &buffy);
+  uint8_t expected = 0;
+  int errors = 0;
+  int received = 0;
+  while (received < STRESS_BYTES) {
+    char buf[16];
+    int n = buffy_tx_buffer_read(&buffy, buf, sizeof(buf));
+    if (n == 0) sched_yield();
+    for (int i = 0; i < n; i++) errors += (uint8_t)buf[i] != expected++;
+    received += n;
+  }
+  pthread_join(producer, NULL);
+  TEST_EQ(errors, 0);
+  TEST_EQ(received, STRESS_BYTES);
+}
+
+// Writes to the RX buffer the way the host does through the debug port.
+static int host_rx_write(struct buffy* t, const uint8_t* data, int len) {
+  uint32_t mask = (1 << t->rx_len_pow2) - 1;
+  uint32_t head = t->rx_head;
+  uint32_t tail = __atomic_load_n(&t->rx_tail, __ATOMIC_ACQUIRE);
+  int free = mask + 1 - (head - tail);
+  int n = len < free ? len : free;
+  for (int i = 0; i < n; i++) t->rx_buf[(head + i) & mask] = data[i];
+  __atomic_store_n(&t->rx_head, head + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+static void* stress_rx_host(void* arg) {
+  struct buffy* t = arg;
+  uint8_t next = 0;
+  uint8_t chunk[5];
+  for (int sent = 0; sent < STRESS_BYTES;) {
+    int len = sizeof(chunk);
+    if (len > STRESS_BYTES - sent) len = STRESS_BYTES - sent;
+    for (int i = 0; i < len; i++) chunk[i] = next + i;
+    int n = host_rx_write(t, chunk, len);
+    if (n == 0) sched_yield();
+    next += n;
+    sent += n;
+  }
+  return NULL;
+}
+
+void test_rx_stress(void) {
+  INSTANTIATE_BUFFY(buffy);
+  pthread_t host;
+  pthread_create(&host, NULL, stress_rx_host, &buffy);
+  uint8_t expected = 0;
+  int errors = 0;
+  int received = 0;
+  while (received < STRESS_BYTES) {
+    char buf[3];
+    int n = buffy_rx(&buffy, buf, sizeof(buf));
+    if (n == 0) sched_yield();
+    for (int i = 0; i < n; i++) errors += (uint8_t)buf[i] != expected++;
+    received += n;
+  }
+  pthread_join(host, NULL);
+  TEST_EQ(errors, 0);
+  TEST_EQ(received, STRESS_BYTES);
+}
+
+TEST_LIST = {{"test_tx_stress", test_tx_stress},
+             {"test_rx_stress", test_rx_stress},
+             {0}};
@@ -0,0 +1,116 @@
+#pragma once
+
+// Helpers shared by the cutest-based tests, C and C++.
+
+#include <cutest.h>
+
+#ifdef __cplusplus
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffy.h"
+
+// Checks that a == b, printing both on failure.
+#define TEST_EQ(a, b)                                             \
+  do {                                                            \
+    auto _a = (a);                                                \
+    auto _b = (b);                                                \
+    TEST_CHECK_(_a == _b, "%s != %s", std::to_string(_a).c_str(), \
+                std::to_string(_b).c_str());                      \
+  } while (0)
+
+// Reads everything out of a TX buffer, chunk_size bytes at a time.
+inline std::string ReadAll(struct buffy* t, size_t chunk_size = 64) {
+  std::string out;
+  std::vector<char> buf(chunk_size);
+  while (int n = buffy_tx_buffer_read(t, buf.data(), buf.size())) {
+    out.append(buf.data(), n);
+  }
+  return out;
+}
+
+// Tick source for buffy_set_tick_hook() that returns fake_ticks.
+inline uint32_t fake_ticks;
+inline uint32_t FakeTick(void) {
+  return fake_ticks;
+}
+
+// Serves a single client on a loopback port, answering each request with
+// the next canned reply, or nothing once they run out.
+class FakeServer {
+ public:
+  // Returns the length of the request at the start of 'pending', framing
+  // included, or 0 if it isn't complete yet.
+  using Framing = std::function<size_t(const std::string& pending)>;
+
+  FakeServer(Framing framing, std::vector<std::string> replies)
+      : framing_(std::move(framing)), replies_(std::move(replies)) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+    listen(listen_fd_, 1);
+    thread_ = std::thread([this]() { Serve(); });
+  }
+
+  // Waits for the client to disconnect.
+  ~FakeServer() {
+    thread_.join();
+    close(listen_fd_);
+  }
+
+  int port() const { return port_; }
+  // Requests as received, framing included. Only valid once the client has
+  // disconnected.
+  const std::vector<std::string>& requests() const { return requests_; }
+
+ private:
+  void Serve() {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    std::string pending;
+    char buf[256];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+      pending.append(buf, n);
+      size_t len;
+      while ((len = framing_(pending)) > 0) {
+        requests_.push_back(pending.substr(0, len));
+        pending.erase(0, len);
+        std::string reply = next_ < replies_.size() ? replies_[next_++] : "";
+        send(fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+      }
+    }
+    close(fd);
+  }
+
+  Framing framing_;
+  std::vector<std::string> replies_;
+  size_t next_ = 0;
+  std::vector<std::string> requests_;
+  int listen_fd_;
+  int port_;
+  std::thread thread_;
+};
+
+#else  // !__cplusplus
+
+// Checks that a == b, printing both on failure.
+#define TEST_EQ(a, b)                          \
+  do {                                         \
+    typeof(a) _a = (a);                        \
+    typeof(b) _b = (b);                        \
+    TEST_CHECK_(_a == _b, "%d != %d", _a, _b); \
+  } while (0)
+
+#endif  // __cplusplus
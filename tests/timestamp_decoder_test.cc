@@ -0,0 +1,161 @@
+#include "timestamp_decoder.h"
+
+#include <math.h>
+
+#include <string>
+#include <vector>
+
+#include <cutest.h>
+
+#include "buffy.h"
+#include "test_util.h"
+
+using buffy_host::TimestampDecoder;
+
+struct Received {
+  bool time_valid;
+  uint64_t ticks;
+  std::string data;
+};
+
+// Collects everything the decoder hands out.
+static void Collect(TimestampDecoder* decoder, std::vector<Received>* out) {
+  decoder->SetRecordCallback([out](const TimestampDecoder::Record& record) {
+    out->push_back({record.time_valid, record.ticks,
+                    std::string(reinterpret_cast<const char*>(record.data),
+                                record.len)});
+  });
+}
+
+static void Feed(TimestampDecoder* decoder, const std::string& data,
+                 double host_time) {
+  decoder->Feed(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+                host_time);
+}
+
+void test_encoding(void) {
+  INSTANTIATE_BUFFY_SIZED(channel, 256, 8);
+  buffy_set_tick_hook(&channel, FakeTick);
+  fake_ticks = 1000;
+  TEST_EQ(buffy_tx_timestamped(&channel, "a", 1), 1);
+  // Absolute: 1000 << 1 | 1 = 2001 = 0xd1 0x0f.
+  TEST_CHECK(ReadAll(&channel) == std::string("\xd1\x0f\x01" "a", 4));
+
+  fake_ticks = 1030;
+  TEST_EQ(buffy_tx_timestamped(&channel, "bc", 2), 2);
+  // Delta: 30 << 1 = 60, a single byte.
+  TEST_CHECK(ReadAll(&channel) == std::string("\x3c\x02" "bc", 4));
+
+  // Doesn't fit, nothing is written and the time base stays.
+  std::string big(300, 'x');
+  TEST_EQ(buffy_tx_timestamped(&channel, big.data(), big.size()), 0);
+  fake_ticks = 1100;
+  TEST_EQ(buffy_tx_timestamped(&channel, "", 0), 0);
+  TEST_CHECK(ReadAll(&channel) == std::string("\x8c\x01\x00", 3));
+}
+
+void test_reconstruct(void) {
+  INSTANTIATE_BUFFY_SIZED(channel, 4096, 8);
+  buffy_set_tick_hook(&channel, FakeTick);
+  TimestampDecoder decoder;
+  std::vector<Received> received;
+  Collect(&decoder, &received);
+
+  // 1 MHz target clock that wraps around during the test, host clock starts
+  // at 100 s.
+  fake_ticks = 0xfff00000;
+  uint64_t ticks = fake_ticks;
+  std::vector<uint64_t> sent;
+  for (int i = 0; i < 300; i++) {
+    uint32_t step = 1000 + i * 37;
+    fake_ticks += step;
+    ticks += step;
+    sent.push_back(ticks);
+    std::string data = std::to_string(i);
+    TEST_EQ(buffy_tx_timestamped(&channel, data.data(), data.size()),
+            static_cast<int>(data.size()));
+    if (i % 10 == 9) {
+      Feed(&decoder, ReadAll(&channel),
+           100 + (ticks - 0xfff00000) / 1e6 + 0.001);
+    }
+  }
+  TEST_EQ(received.size(), sent.size());
+  for (size_t i = 0; i < received.size(); i++) {
+    TEST_CHECK(received[i].time_valid);
+    TEST_EQ(received[i].ticks, sent[i]);
+    TEST_CHECK(received[i].data == std::to_string(i));
+  }
+  TEST_CHECK(received.back().ticks > 0xffffffffu);
+
+  const buffy_host::ClockEstimator& clock = decoder.clock();
+  TEST_CHECK(clock.ready());
+  TEST_CHECK(fabs(clock.ticks_per_second() - 1e6) < 1);
+  TEST_CHECK(fabs(clock.ToHostTime(sent[100]) -
+                  (100 + (sent[100] - 0xfff00000) / 1e6 + 0.001)) < 1e-6);
+}
+
+void test_resync(void) {
+  INSTANTIATE_BUFFY_SIZED(channel, 4096, 8);
+  buffy_set_tick_hook(&channel, FakeTick);
+  TimestampDecoder decoder;
+  std::vector<Received> received;
+  Collect(&decoder, &received);
+
+  fake_ticks = 0;
+  for (int i = 0; i < BUFFY_TIMESTAMP_SYNC_INTERVAL + 1; i++) {
+    fake_ticks += 10;
+    buffy_tx_timestamped(&channel, "x", 1);
+    std::string data = ReadAll(&channel);
+    // Lose the first few records, as if they were overwritten.
+    if (i == 5) decoder.Reset();
+    if (i >= 5) Feed(&decoder, data, 0);
+  }
+  TEST_EQ(received.size(), BUFFY_TIMESTAMP_SYNC_INTERVAL - 4u);
+  TEST_CHECK(!received[0].time_valid);
+  // Next absolute timestamp.
+  TEST_CHECK(received.back().time_valid);
+  TEST_EQ(received.back().ticks, 10u * (BUFFY_TIMESTAMP_SYNC_INTERVAL + 1));
+}
+
+void test_corrupt(void) {
+  INSTANTIATE_BUFFY_SIZED(channel, 256, 8);
+  buffy_set_tick_hook(&channel, FakeTick);
+  TimestampDecoder decoder;
+  decoder.set_buffer_size(256);
+  std::vector<Received> received;
+  Collect(&decoder, &received);
+
+  // A time varint of 6 bytes, then a record that claims to be longer than
+  // the buffer: both are dropped, not waited on.
+  Feed(&decoder, std::string("\x81\x81\x81\x81\x81\x01\x00", 7), 1.0);
+  TEST_EQ(decoder.errors(), 1u);
+  Feed(&decoder, std::string("\x03\x81\x02", 3), 1.0);
+  TEST_EQ(decoder.errors(), 2u);
+  TEST_EQ(received.size(), 0u);
+
+  // Deltas have no time to go on, the next absolute time resyncs.
+  fake_ticks = 500;
+  TEST_EQ(buffy_tx_timestamped(&channel, "a", 1), 1);
+  std::string absolute = ReadAll(&channel);
+  fake_ticks = 510;
+  TEST_EQ(buffy_tx_timestamped(&channel, "b", 1), 1);
+  Feed(&decoder, ReadAll(&channel), 2.0);
+  Feed(&decoder, absolute, 3.0);
+  if (!TEST_CHECK(received.size() == 2)) return;
+  TEST_CHECK(!received[0].time_valid);
+  TEST_CHECK(received[1].time_valid);
+  TEST_EQ(received[1].ticks, 500u);
+
+  // The length fits, but not along with the 3 header bytes.
+  Feed(&decoder, std::string("\x02\xfe\x01", 3), 4.0);
+  TEST_EQ(decoder.errors(), 3u);
+  Feed(&decoder, std::string("\x02\xfd\x01", 3), 4.0);
+  TEST_EQ(decoder.errors(), 3u);
+  TEST_EQ(received.size(), 2u);
+}
+
+TEST_LIST = {{"test_encoding", test_encoding},
+             {"test_reconstruct", test_reconstruct},
+             {"test_resync", test_resync},
+             {"test_corrupt", test_corrupt},
+             {0}};
@@ -0,0 +1,157 @@
+// End to end throughput of Reader over the OpenOCD TCL and GDB remote
+// transports, against TclServer and GdbServer standing in for the debug
+// server and adapter.
+//
+// A producer thread calls buffy_tx() at a fixed rate while the reader polls
+// as fast as the transport allows. Prints one CSV line per configuration to
+// stdout:
+//
+//   mode,latency_us,bandwidth,offered_bps,drained_bps,dropped,round_trips,polls
+//
+// mode:        tcl_batched (a poll is a single buffy_poll command, see
+//              TargetMemory::DrainTx()), tcl_separate (read_memory and
+//              write_memory commands for the header, data and tail), or gdb
+//              (m and M packets for the same).
+// latency_us:  added to every command or packet by the server.
+// bandwidth:   target memory bytes per second the server moves, 0 for no
+//              limit.
+// offered_bps: bytes per second the producer tried to write.
+// drained_bps: bytes per second the reader got.
+// dropped:     bytes buffy_tx() didn't take because the buffer was full.
+//
+// Usage: transport_bench [time_ms] [offered_bytes_per_second]
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "buffy.h"
+#include "gdb_remote.h"
+#include "gdb_server.h"
+#include "openocd_tcl.h"
+#include "reader.h"
+#include "simulated_target.h"
+#include "tcl_server.h"
+
+INSTANTIATE_BUFFY(channel);
+
+namespace {
+
+using buffy_host::GdbRemote;
+using buffy_host::GdbServer;
+using buffy_host::OpenOcdTcl;
+using buffy_host::Reader;
+using buffy_host::SimulatedTarget;
+using buffy_host::TclServer;
+using Clock = std::chrono::steady_clock;
+
+constexpr int kMessageSize = 64;
+
+int64_t time_ms = 500;
+double offered_bps = 256 * 1024;
+
+// Drains 'channel' through 'transport' (OpenOcdTcl or GdbRemote), which is
+// connected to a server serving 'target'.
+template <typename Transport>
+void Bench(const char* mode, Transport* transport, int latency_us,
+           double bandwidth) {
+  Reader reader(transport, SimulatedTarget::kBuffyAddr);
+  if (!reader.Attach()) {
+    fprintf(stderr, "can't attach: %s\n", reader.error().c_str());
+    exit(1);
+  }
+  uint64_t drained = 0;
+  reader.SetDataCallback([&](const uint8_t*, size_t len) { drained += len; });
+  uint64_t round_trips = transport->round_trips();
+
+  std::atomic<bool> done{false};
+  uint64_t offered = 0;
+  uint64_t dropped = 0;
+  Clock::time_point start = Clock::now();
+  std::thread producer([&]() {
+    char data[kMessageSize] = {};
+    auto period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(kMessageSize / offered_bps));
+    Clock::time_point next = start;
+    while (!done.load(std::memory_order_acquire)) {
+      offered += kMessageSize;
+      dropped += kMessageSize - buffy_tx(&channel, data, kMessageSize);
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+  });
+
+  uint64_t polls = 0;
+  Clock::time_point end = start + std::chrono::milliseconds(time_ms);
+  while (Clock::now() < end) {
+    polls++;
+    if (reader.Poll() < 0) {
+      fprintf(stderr, "poll failed: %s\n", transport->error().c_str());
+      exit(1);
+    }
+  }
+  done.store(true, std::memory_order_release);
+  producer.join();
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  printf("%s,%d,%.0f,%.0f,%.0f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+         mode, latency_us, bandwidth, offered / seconds, drained / seconds,
+         dropped, transport->round_trips() - round_trips, polls);
+  fflush(stdout);
+}
+
+void BenchTcl(bool batched, int latency_us, double bandwidth) {
+  channel.tx_tail = channel.tx_head = 0;
+  SimulatedTarget target(&channel);
+  TclServer::Options options;
+  options.latency = std::chrono::microseconds(latency_us);
+  options.bandwidth = bandwidth;
+  TclServer server(&target, options);
+  OpenOcdTcl tcl;
+  if (!server.Start() || !tcl.Connect("127.0.0.1", server.port())) {
+    fprintf(stderr, "can't connect: %s\n", tcl.error().c_str());
+    exit(1);
+  }
+  tcl.set_drain_tx(batched);
+  Bench(batched ? "tcl_batched" : "tcl_separate", &tcl, latency_us,
+        bandwidth);
+}
+
+void BenchGdb(int latency_us, double bandwidth) {
+  channel.tx_tail = channel.tx_head = 0;
+  SimulatedTarget target(&channel);
+  GdbServer::Options options;
+  options.latency = std::chrono::microseconds(latency_us);
+  options.bandwidth = bandwidth;
+  GdbServer server(&target, options);
+  GdbRemote gdb;
+  if (!server.Start() || !gdb.Connect("127.0.0.1", server.port())) {
+    fprintf(stderr, "can't connect: %s\n", gdb.error().c_str());
+    exit(1);
+  }
+  Bench("gdb", &gdb, latency_us, bandwidth);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc > 1) time_ms = atoll(argv[1]);
+  if (argc > 2) offered_bps = atof(argv[2]);
+
+  printf("mode,latency_us,bandwidth,offered_bps,drained_bps,dropped,"
+         "round_trips,polls\n");
+  for (int latency_us : {0, 100, 1000}) {
+    for (double bandwidth : {0.0, 1e6}) {
+      for (bool batched : {true, false}) {
+        BenchTcl(batched, latency_us, bandwidth);
+      }
+      BenchGdb(latency_us, bandwidth);
+    }
+  }
+  return 0;
+}